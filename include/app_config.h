@@ -0,0 +1,241 @@
+// ビルド時の設定（config.h の値と、config.h で未定義の項目のデフォルト値）
+// 各モジュールはこのヘッダーを通して config.h を読み込む
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"  // 設定ファイル
+#include "photo_util.h"
+
+// config.hで未定義の項目のデフォルト値
+#ifndef UPLOAD_CHUNK_SIZE
+#define UPLOAD_CHUNK_SIZE 16384  // 1回のwrite()で渡す最大バイト数（TLSレコード最大長）
+#endif
+#ifndef OFFLINE_DRAIN_TIME_BUDGET
+#define OFFLINE_DRAIN_TIME_BUDGET 120000  // 1回のキュー送信に使う最大時間（ミリ秒）
+#endif
+#ifndef OFFLINE_DRAIN_MIN_BATTERY
+#define OFFLINE_DRAIN_MIN_BATTERY 20  // キュー送信を続ける最低バッテリー残量（%）
+#endif
+#ifndef DEEP_SLEEP_TIMER_MODE
+#define DEEP_SLEEP_TIMER_MODE 0  // 1: 撮影間隔の間はDeep sleep（バッテリー運用向け）
+#endif
+#ifndef DEEP_SLEEP_AWAKE_GRACE
+#define DEEP_SLEEP_AWAKE_GRACE 60000  // ボタン・電源投入で起動した後、Deep sleepに入るまでの待機（ミリ秒）
+#endif
+#ifndef DEBUG_BOOT
+#define DEBUG_BOOT 0  // 1: タイマー復帰時も起動診断を表示
+#endif
+#ifndef SHOT_TIMING_HEADER
+#define SHOT_TIMING_HEADER 1  // 1: アップロード時にX-Shot-Timingヘッダーで直近の処理時間を送る
+#endif
+#ifndef BURST_FRAME_COUNT
+#define BURST_FRAME_COUNT 5  // バースト撮影の枚数（ボタン1〜3秒押し）
+#endif
+#ifndef BURST_FPS
+#define BURST_FPS 2  // バースト撮影のフレームレート（枚/秒）
+#endif
+#ifndef TIMELAPSE_INTERVAL_SEC
+#define TIMELAPSE_INTERVAL_SEC 0  // 0以外: PHOTO_INTERVAL_HOURSの代わりに秒単位のタイムラプス撮影
+#endif
+#ifndef MOTION_DETECTION
+#define MOTION_DETECTION 0  // 1: 定時撮影で前回アップロードから変化がなければ送信しない
+#endif
+#ifndef MOTION_THRESHOLD
+#define MOTION_THRESHOLD 3  // 変化ありと判定する平均輝度差（0〜127階調）
+#endif
+#ifndef BATTERY_CAPACITY_MAH
+#define BATTERY_CAPACITY_MAH 270  // 内蔵バッテリー容量（mAh、Timer CAMは270mAh）
+#endif
+#ifndef BATTERY_TARGET_DAYS
+#define BATTERY_TARGET_DAYS 0  // 満充電からの目標稼働日数（0 = 撮影間隔を電池残量で調整しない）
+#endif
+#ifndef BATTERY_MAX_INTERVAL_SCALE
+#define BATTERY_MAX_INTERVAL_SCALE 8  // 目標達成のため撮影間隔を延ばす上限（設定値の倍数）
+#endif
+#ifndef BATTERY_DEFER_LEVEL
+#define BATTERY_DEFER_LEVEL 10  // 電池残量がこれを下回ったらアップロードせずオフラインキューに保存（%）
+#endif
+#ifndef POWER_CAMERA_MA
+#define POWER_CAMERA_MA 110  // 撮影中（カメラ初期化・露出待ち・取得）の平均電流（mA）
+#endif
+#ifndef POWER_RADIO_MA
+#define POWER_RADIO_MA 170  // WiFi接続・TLS・送受信中の平均電流（mA）
+#endif
+#ifndef POWER_IDLE_MA
+#define POWER_IDLE_MA 45  // 起動中でカメラ・無線以外の時間の平均電流（mA）
+#endif
+#ifndef POWER_SLEEP_UA
+#define POWER_SLEEP_UA 150  // 撮影間の待機（スリープ）中の平均電流（µA）
+#endif
+#ifndef POWER_TELEMETRY_HEADER
+#define POWER_TELEMETRY_HEADER 1  // 1: X-Powerヘッダーで電池・消費電力の推定値を送信
+#endif
+#ifndef THUMBNAIL_UPLOAD
+#define THUMBNAIL_UPLOAD 0  // 1: 縮小プレビューを生成して本画像より先に thumbs/ へアップロード
+#endif
+#ifndef THUMBNAIL_SCALE
+#define THUMBNAIL_SCALE 4  // サムネイルの縮小率（2, 4, 8。VGAの1/4 = 160x120）
+#endif
+#ifndef THUMBNAIL_QUALITY
+#define THUMBNAIL_QUALITY 60  // サムネイルのJPEG品質（1〜100、大きいほど高画質）
+#endif
+#ifndef THUMBNAIL_FULL_FRAME
+#define THUMBNAIL_FULL_FRAME 1  // 1: 本画像もサムネイルの後に送信、0: サムネイルのみ送信
+#endif
+#ifndef MOTION_FORCE_UPLOAD_EVERY
+#define MOTION_FORCE_UPLOAD_EVERY 12  // 変化がなくてもこの回数に1回は送信
+#endif
+#ifndef ADAPTIVE_ENCODER
+#define ADAPTIVE_ENCODER 1  // 1: 電波状況・スループット・電池残量から解像度と画質を撮影ごとに選択
+#endif
+#ifndef ENCODER_AIRTIME_TARGET_MS
+#define ENCODER_AIRTIME_TARGET_MS 3000  // 1枚の送信にかける目標時間（ミリ秒）
+#endif
+#ifndef ENCODER_BEST_LEVEL
+#define ENCODER_BEST_LEVEL 2  // 使用する最高画質の段階（0 = SVGA, 2 = VGA品質12）
+#endif
+#ifndef WARMUP_MAX_FRAMES
+#define WARMUP_MAX_FRAMES 10  // カメラ起動後、露出安定を待つ最大フレーム数
+#endif
+#ifndef WARMUP_STABLE_FRAMES
+#define WARMUP_STABLE_FRAMES 2  // 露出が安定したとみなす連続フレーム数
+#endif
+#ifndef WARMUP_TOLERANCE_PERCENT
+#define WARMUP_TOLERANCE_PERCENT 5  // フレーム間の露出変化がこの割合以内なら安定
+#endif
+#ifndef HOUSEKEEPING_INTERVAL
+#define HOUSEKEEPING_INTERVAL 300000  // 状態表示・ヒープ報告の間隔（ミリ秒）
+#endif
+#ifndef HEAP_MIN_BLOCK
+#define HEAP_MIN_BLOCK 20000  // 撮影・TLS接続に必要な内部ヒープの最大連続ブロック（バイト）
+#endif
+#ifndef HEAP_RESTART_MIN_BLOCK
+#define HEAP_RESTART_MIN_BLOCK 16384  // 最大連続ブロックがこれを下回ったらアイドル時に再起動（0 = 無効）
+#endif
+#ifndef LOCAL_STREAM_ENABLED
+#define LOCAL_STREAM_ENABLED 1  // 1: ボタン2回押しでローカル配信モード（MJPEG /stream, 単発 /capture）
+#endif
+#ifndef LOCAL_STREAM_IDLE_TIMEOUT
+#define LOCAL_STREAM_IDLE_TIMEOUT 600000  // 閲覧者がいない状態が続いたら配信モードを終了（ミリ秒）
+#endif
+#ifndef DOUBLE_PRESS_WINDOW
+#define DOUBLE_PRESS_WINDOW 400  // 2回押しと判定する間隔（ミリ秒）
+#endif
+#ifndef REMOTE_CONFIG_ENABLED
+#define REMOTE_CONFIG_ENABLED 1  // 1: アップロード接続を使ってリモート設定を定期取得
+#endif
+#ifndef REMOTE_CONFIG_PATH
+#define REMOTE_CONFIG_PATH "config/settings.json"  // BUCKET_NAME内の設定ファイル
+#endif
+#ifndef REMOTE_CONFIG_INTERVAL_SEC
+#define REMOTE_CONFIG_INTERVAL_SEC 21600  // リモート設定の確認間隔（秒）
+#endif
+#ifndef LOOP_IDLE_WAIT_MAX
+#define LOOP_IDLE_WAIT_MAX 1000  // イベントがない時にloop()が待機する最大時間（ミリ秒）
+#endif
+#ifndef BENCHMARK_MODE
+#define BENCHMARK_MODE 0  // 1: 起動後に撮影・アップロードのベンチマークを実行（env:m5stack-timer-cam-bench）
+#endif
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 20  // ベンチマークの撮影・アップロード回数
+#endif
+#ifndef BENCH_KEEPALIVE
+#define BENCH_KEEPALIVE 1  // 0: 毎回接続を閉じてハンドシェイク込みで計測
+#endif
+#ifndef BENCH_PORT
+#define BENCH_PORT 8443
+#endif
+#ifndef UPLOAD_PIPELINE_DEPTH
+#define UPLOAD_PIPELINE_DEPTH 4  // 応答を待たずに先行送信するリクエスト数（1 = パイプラインなし）
+#endif
+#ifndef TIME_SNTP_RESYNC_SEC
+#define TIME_SNTP_RESYNC_SEC 86400  // 応答のDateヘッダーで補正できない期間がこれを超えたらSNTPで再同期（秒）
+#endif
+#ifndef TIME_COLD_BOOT_WAIT_MS
+#define TIME_COLD_BOOT_WAIT_MS 3000  // 電源投入時（時刻未設定）にSNTPを待つ最大時間（ミリ秒）
+#endif
+#ifndef FLEET_SLOT_SPREAD_SEC
+#define FLEET_SLOT_SPREAD_SEC 300  // 撮影を壁時計の区切り＋端末ごとのオフセット（MACから決定、この秒数未満）に揃える（0 = 起動基準）
+#endif
+#ifndef FLEET_BOOT_JITTER_MS
+#define FLEET_BOOT_JITTER_MS 10000  // 電源投入時、APに接続するまで端末ごとにずらす最大時間（ミリ秒）
+#endif
+#ifndef SERVER_BACKOFF_DEFAULT_SEC
+#define SERVER_BACKOFF_DEFAULT_SEC 60  // 429/503でRetry-Afterがない時の最初の待機（秒、続くと倍々に延長）
+#endif
+#ifndef SERVER_BACKOFF_MAX_SEC
+#define SERVER_BACKOFF_MAX_SEC 3600  // サーバー指示による送信停止の上限（秒）
+#endif
+#ifndef SUPABASE_SPKI_PINS
+#define SUPABASE_SPKI_PINS ""  // サーバー証明書の公開鍵（SPKI）のSHA-256（16進、カンマ区切りで最大3件、空 = 照合なし）
+#endif
+#ifndef TLS_VERIFY_CHAIN
+#define TLS_VERIFY_CHAIN 1  // 1: サーバー証明書のチェーンを include/root_ca.h のルート証明書で検証
+#endif
+#ifndef RESUMABLE_UPLOAD
+#define RESUMABLE_UPLOAD 0  // 1: 大きいフレームは再開可能アップロード（tus）で送信
+#endif
+// 既定は無効: Supabaseは最後以外のPATCHを6MBに固定しており、小さく区切って受信確認を取れない。
+// MAX_FRAME_SIZE（500KB）は6MBより小さいため1フレームは常に1回のPATCHになり、
+// 再開で省けるのは切断までにサーバーが保存した分（HEADで返る Upload-Offset）だけで、作成のPOST1回分は常に余計にかかる
+#ifndef RESUMABLE_UPLOAD_MIN_SIZE
+#define RESUMABLE_UPLOAD_MIN_SIZE 131072  // 再開可能アップロードを使う最小フレームサイズ（バイト）
+#endif
+#ifndef RESUMABLE_CHUNK_SIZE
+#define RESUMABLE_CHUNK_SIZE (6 * 1024 * 1024)  // PATCH 1回のサイズ（Supabaseは6MB固定）
+#endif
+#ifndef RESUMABLE_MAX_ATTEMPTS
+#define RESUMABLE_MAX_ATTEMPTS 3  // 1回の送信で接続を張り直して再開する最大回数
+#endif
+#ifndef UPLOAD_WAIT_MODEM_SLEEP
+#define UPLOAD_WAIT_MODEM_SLEEP 1  // 1: レスポンス待ちの間はWiFiモデムスリープ
+#endif
+#ifndef PIPELINE_SLOT_COUNT
+#define PIPELINE_SLOT_COUNT 3  // PSRAMフレームスロット数（撮影とアップロードの並行度）
+#endif
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 3  // シリアルに出すログの最大レベル（0 = なし, 1 = エラー, 2 = 警告, 3 = 情報, 4 = デバッグ）
+#endif
+#ifndef LOG_RING_RECORDS
+#define LOG_RING_RECORDS 32  // RTCメモリのログリングの行数（2のべき乗、Deep sleep・リセット後も保持）
+#endif
+#ifndef LOG_FULL_WAIT_MS
+#define LOG_FULL_WAIT_MS 50  // リングが満杯の時に書き出しを待つ最大時間（超えたら古い行を上書き）
+#endif
+#ifndef LOG_TAIL_UPLOAD
+#define LOG_TAIL_UPLOAD 0  // 1: 警告・エラーがあれば直近のログを次の写真と一緒に logs/ へアップロード
+#endif
+#ifndef PHOTO_NOTIFY
+#define PHOTO_NOTIFY 0  // 1: アップロード成功後、同じ接続でREST APIのテーブルにメタデータを1行追加
+#endif
+#ifndef PHOTO_NOTIFY_TABLE
+#define PHOTO_NOTIFY_TABLE "photo_uploads"  // 追加先のテーブル（path, size, uploaded_at, timing 列）
+#endif
+
+// Supabase設定（config.hの値からホスト名・ポートをコンパイル時に求め、不正なURLはビルドエラーにする）
+constexpr char SUPABASE_URL_TEXT[] = SUPABASE_URL;
+struct BuildConfig {
+    const char* supabaseUrl;
+    const char* serviceKey;
+    const char* defaultBucket;
+    const char* host;      // supabaseUrl 内のホスト名の先頭（NUL終端ではない）
+    size_t hostLength;
+    uint32_t port;         // URLに ":ポート" がなければ443
+};
+constexpr BuildConfig CONFIG = {
+    SUPABASE_URL_TEXT,
+    SUPABASE_SERVICE_KEY,
+    BUCKET_NAME,
+    SUPABASE_URL_TEXT + urlSchemeLength(SUPABASE_URL_TEXT),
+    urlHostLength(SUPABASE_URL_TEXT + urlSchemeLength(SUPABASE_URL_TEXT)),
+    urlPort(SUPABASE_URL_TEXT + urlSchemeLength(SUPABASE_URL_TEXT) +
+            urlHostLength(SUPABASE_URL_TEXT + urlSchemeLength(SUPABASE_URL_TEXT))),
+};
+static_assert(CONFIG.hostLength > 0 && CONFIG.hostLength < 64, "SUPABASE_URL must be https://<host>[:port] (host up to 63 chars)");
+static_assert(CONFIG.port > 0 && CONFIG.port <= 65535, "SUPABASE_URL port is out of range");
+
+// ピン定義
+#define CAMERA_LED_GPIO 2
+#define EXTERNAL_BUTTON_GPIO 4  // 外部ボタン（EXT_PIN_1）- プルアップ抵抗付きで制御可能
+#define POWER_BUTTON_GPIO 38  // 本体ボタン（input-only, 制御不可）
@@ -0,0 +1,52 @@
+// ログ出力（各タスクはRTCメモリのリングに書き込み、ログタスクがシリアルへ出力）
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "app_config.h"
+
+// ログレベル（LOG_LEVELを超えるレベルの呼び出しはコンパイル時に除去）
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_AT(level, ...) do { if (LOG_LEVEL >= (level)) logWrite((level), __VA_ARGS__); } while (0)
+#define LOG_E(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_W(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_I(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_D(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// ログリング: 各タスクは整形した1行を書き込むだけで戻り、UARTへの出力はログタスクが行う
+// 書き込み位置は fetch_add で確保し、行ごとの seq（通し番号+1）で書き込み完了を示す（複数生産者・単一消費者）
+// RTC_NOINIT に置くため、Deep sleep・パニック・WDTリセットの直前のログも次の起動で出力される
+const int LOG_TEXT_SIZE = 116; // 1行の最大長（ヘッダー込みで1行128バイト）
+const uint32_t LOG_MAGIC = 0x4c4f4731; // "LOG1"
+const uint32_t LOG_SEQ_DISCARDED = 0xffffffff; // リセットで書き込みが完了しなかった行
+static_assert((LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) == 0, "LOG_RING_RECORDS must be a power of two");
+struct LogRecord {
+    std::atomic<uint32_t> seq;  // 書き込み完了した通し番号+1（書き込み中は0）
+    uint32_t ms;
+    uint8_t level;
+    char text[LOG_TEXT_SIZE];
+};
+struct LogRing {
+    uint32_t magic;
+    std::atomic<uint32_t> writeIndex;  // 次に確保する通し番号（生産者）
+    std::atomic<uint32_t> flushIndex;  // 次にシリアルへ出す通し番号（ログタスク）
+    uint32_t tailIndex;                // 次のログ送信に含める最初の通し番号
+    std::atomic<bool> tailPending;     // 前回のログ送信以降に警告・エラーがあった
+    LogRecord records[LOG_RING_RECORDS];
+};
+extern LogRing logRing;
+
+// ログ送信用の整形バッファ（LOG_TAIL_UPLOAD 有効時のみPSRAMプールから確保）
+const size_t LOG_TAIL_BUFFER_SIZE = LOG_RING_RECORDS * (LOG_TEXT_SIZE + 16);
+extern char* logTailBuffer;
+
+void initLogRing(esp_reset_reason_t resetReason);
+void logWrite(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+bool startLogTask();
+void logTask(void* param);
+void drainLogRing();
+void logFlush();
+size_t formatLogTail(char* out, size_t outSize, uint32_t& endIndex);
@@ -0,0 +1,31 @@
+// 複数のモジュール・タスクが共有する状態（定義は main.cpp）
+#pragma once
+
+#include <Arduino.h>
+
+// Deep sleepをまたいで保持するスケジュール状態（RTCメモリ）
+// 時刻はDeep sleep中もRTCタイマーで進むtime()の値（NTP未同期でも単調増加）
+struct RtcScheduleState {
+    uint32_t bootCount;
+    uint32_t photoCount;
+    time_t lastPhotoEpoch;
+    time_t nextShotEpoch;       // 次回撮影の絶対時刻（0 = 未設定）
+    uint32_t queuePending;      // オフラインキューの未送信数
+    uint32_t queueNextSeq;      // オフラインキューの次の連番
+};
+extern RtcScheduleState rtcState;
+extern bool timerWakeBoot;     // タイマーによるDeep sleep復帰で起動したか
+extern unsigned long lastActivityTime;
+extern unsigned long lastPhotoTime;
+
+extern SemaphoreHandle_t cameraMutex;  // カメラドライバーの排他（撮影タスク・配信ハンドラー・逐次撮影）
+extern SemaphoreHandle_t wifiMutex;    // WiFi接続処理の排他（アップロードタスクとloop()から呼ばれる）
+
+// フェーズ統計・電源状態・エンコーダー状態は撮影・アップロード・定期処理・loop()の各タスクが読み書きする
+// 更新とコピーは stateMux の短いクリティカルセクション内で行い、ログ出力や計測はコピーに対して行う
+// 時刻補正でずらすRTCの予定時刻（次回撮影・前回撮影・設定確認・送信停止）の書き込みも stateMux で守る
+extern portMUX_TYPE stateMux;
+
+// loop()を起こすイベント通知（ボタン割り込み・撮影/アップロード完了）
+extern TaskHandle_t mainLoopTaskHandle;
+void notifyMainLoop();
@@ -0,0 +1,4 @@
+// ベンチマーク（BENCHMARK_MODE 有効時、起動後に撮影・アップロードを繰り返して計測）
+#pragma once
+
+void runBenchmark();
@@ -0,0 +1,61 @@
+// カメラ撮影（露出の安定待ち・解像度と画質の選択・変化検出・サムネイル）
+#pragma once
+
+#include "M5TimerCAM.h"
+#include "app_config.h"
+
+// 解像度と画質の段階（高画質順）。送信バイト予算に応じて1段階ずつ上下する
+struct EncoderLevel {
+    framesize_t framesize;
+    uint8_t quality;  // 10-63, 低いほど高品質
+};
+const EncoderLevel ENCODER_LEVELS[] = {
+    {FRAMESIZE_SVGA, 12},
+    {FRAMESIZE_VGA, 10},
+    {FRAMESIZE_VGA, 12},   // 初期値
+    {FRAMESIZE_VGA, 18},
+    {FRAMESIZE_HVGA, 18},
+    {FRAMESIZE_QVGA, 18},
+    {FRAMESIZE_QVGA, 28},
+};
+const int ENCODER_LEVEL_COUNT = sizeof(ENCODER_LEVELS) / sizeof(ENCODER_LEVELS[0]);
+const int ENCODER_DEFAULT_LEVEL = 2;
+
+// 撮影ごとの選択に使う測定値（Deep sleep後も保持）
+struct EncoderState {
+    int8_t level;
+    int8_t lastRssi;          // 0 = 未測定
+    uint32_t throughputBps;   // 送信スループットの移動平均（0 = 未測定）
+    uint32_t lastFrameBytes;  // 直近のフレームサイズ
+};
+extern EncoderState encoderState;
+
+// 変化検出用の縮小デコードに必要なバッファの大きさ
+const size_t MOTION_DECODE_BUFFER_SIZE = (2048 / 8) * (1536 / 8) * 2; // QXGAの1/8 RGB565
+
+// サムネイル（JPEGを縮小デコードしてから再エンコード、出力はスロットごとのバッファ）
+#define THUMBNAIL_PREFIX "thumbs/"
+static_assert(THUMBNAIL_SCALE == 2 || THUMBNAIL_SCALE == 4 || THUMBNAIL_SCALE == 8,
+              "THUMBNAIL_SCALE must be 2, 4 or 8 (JPEG decoder scales)");
+const size_t THUMBNAIL_MAX_SIZE = 16384;
+const size_t THUMBNAIL_DECODE_BUFFER_SIZE =
+    (800 / THUMBNAIL_SCALE) * (600 / THUMBNAIL_SCALE) * 2; // 最大解像度（SVGA）の縮小RGB565
+
+// 縮小デコード用バッファ（変化検出・サムネイル共用、撮影を行うタスクのみが使う）
+// デコーダー自身の作業領域（約3KB）は jpg2rgb565 が呼び出しごとに内部ヒープから確保する
+extern uint8_t* decodeBuffer;
+extern size_t decodeBufferSize;
+
+bool takePhoto();
+bool isSceneUnchanged(const camera_fb_t* fb);
+size_t writeThumbnailChunk(void* arg, size_t index, const void* data, size_t len);
+size_t makeThumbnail(const uint8_t* jpeg, size_t jpegLength, uint16_t width, uint16_t height,
+                     uint8_t* out, size_t outSize);
+void makeThumbnailFilename(char* out, size_t outSize, const char* filename);
+void applyEncoderLevel(int level);
+bool readSensorExposure(uint32_t& exposure, uint16_t& gain);
+void restoreSensorExposure();
+bool captureAfterWarmUp();
+void selectEncoderLevel();
+void makePhotoFilename(char* out, size_t outSize, const char* suffix);
+EncoderState encoderSnapshot();
@@ -0,0 +1,52 @@
+// 撮影パイプライン（撮影タスクがPSRAMスロットに書き込み、アップロードタスクが送信）
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "app_config.h"
+#include "supabase_upload.h"
+
+const size_t MAX_FRAME_SIZE = 500000; // 1フレームの上限サイズ（バイト）
+
+// スロット番号を受け渡す単一生産者・単一消費者のロックフリーリング
+// tail は生産者のみ、head は消費者のみが書き換える（インデックスは単調増加）
+struct SlotRing {
+    static const uint32_t CAPACITY = 8;
+    int items[CAPACITY];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+};
+static_assert(PIPELINE_SLOT_COUNT <= (int)SlotRing::CAPACITY, "PIPELINE_SLOT_COUNT exceeds SlotRing capacity");
+extern SlotRing readySlotRing;  // アップロード待ちスロット（撮影タスク → アップロードタスク）
+
+extern uint8_t* drainBuffer;  // オフラインキュー送信の読み出し用（アップロード側が使用）
+extern std::atomic<bool> heapRestartPending;
+extern TaskHandle_t uploadTaskHandle;
+extern bool pipelineRunning;
+extern std::atomic<bool> offlineDrainRequested;
+extern std::atomic<bool> pipelineStopping;  // シャットダウン中（撮影要求は破棄し、撮影済みはキューへ）
+
+// 撮影要求（要求ごとに種類を持たせ、変化検出の有無が別の要求に移らないようにする）
+enum CaptureRequest : uint8_t { CAPTURE_SHOT, CAPTURE_CHECKED_SHOT, CAPTURE_BURST };
+
+void takeAndUploadPhoto(bool checkChange = false);
+void uploadFrame(uint8_t* imageData, size_t imageSize, const char* filename);
+void uploadFrameBatch(UploadItem* items, int count);
+bool captureIntoSlot(int slotIndex, const char* suffix, bool checkChange = false);
+void captureBurst();
+void requestBurstCapture();
+bool initFramePool();
+void sampleHeapTrend();
+bool startCapturePipeline();
+bool stopCapturePipeline();
+bool isPipelineIdle();
+void captureTask(void* param);
+void requestCapture(CaptureRequest request);
+bool slotRingPush(SlotRing& ring, int slotIndex);
+bool slotRingPop(SlotRing& ring, int& slotIndex);
+uint32_t slotRingCount(const SlotRing& ring);
+bool acquireFreeSlot(int& slotIndex, uint32_t timeoutMs);
+bool startHousekeepingTask();
+void housekeepingTask(void* param);
+void printSystemStatus();
+void uploadTask(void* param);
@@ -0,0 +1,13 @@
+// ローカル配信モード（設置・画角調整用、読み取り専用）
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+extern std::atomic<bool> localStreamActive;
+extern std::atomic<int> localStreamClients;
+extern std::atomic<uint32_t> localStreamLastActivity;
+extern uint8_t* streamFrameBuffer;  // 配信用フレームのコピー先（PSRAMプールから確保）
+
+bool startLocalStream();
+void stopLocalStream();
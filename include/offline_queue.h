@@ -0,0 +1,22 @@
+// オフラインキュー（送信できなかったフレームをLittleFSに保存し、再起動後も再送）
+#pragma once
+
+#include <Arduino.h>
+#include "supabase_upload.h"
+
+extern int offlineQueueCount;
+extern uint32_t offlineQueueNextSeq;
+
+bool initOfflineQueue(bool skipIndex);
+void removeOfflineEntry(uint32_t seq);
+bool appendOfflineIndex(const char* record);
+bool enqueueOfflineFrame(const uint8_t* imageData, size_t imageSize, const char* filename,
+                         const ResumableUpload* resume = nullptr);
+bool storeOfflineFrame(const uint8_t* imageData, size_t imageSize, const char* filename,
+                       const ResumableUpload* resume);
+void initResumableUpload(ResumableUpload& resume, uint32_t queueSeq);
+bool loadResumableState(ResumableUpload& resume);
+void saveResumableState(const ResumableUpload& resume);
+void completeOfflineEntry(uint32_t seq);
+void drainOfflineQueue(uint8_t* buffer, size_t bufferSize);
+void requestOfflineDrain();
@@ -0,0 +1,371 @@
+// 端末のハードウェアに依存しない処理（ホストPCで単体テストできるよう main.cpp から分離）
+// ここには Arduino / ESP-IDF のAPIを使う処理やログ出力を置かない
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+// 処理フェーズ1つ分の所要時間の統計
+struct PhaseStats {
+    uint32_t count;
+    uint32_t lastUs;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint32_t avgUs;     // 指数移動平均（直近の傾向を重視）
+};
+
+// 1回分の所要時間を統計に加える（平均は重み1/8の指数移動平均）
+inline void updatePhaseStats(PhaseStats& stats, uint32_t elapsedUs) {
+    if (stats.count == 0) {
+        stats.minUs = elapsedUs;
+        stats.maxUs = elapsedUs;
+        stats.avgUs = elapsedUs;
+    } else {
+        if (elapsedUs < stats.minUs) stats.minUs = elapsedUs;
+        if (elapsedUs > stats.maxUs) stats.maxUs = elapsedUs;
+        stats.avgUs = stats.avgUs - stats.avgUs / 8 + elapsedUs / 8;
+    }
+    stats.lastUs = elapsedUs;
+    stats.count++;
+}
+
+// Supabase URLの解析（config.hの値からホスト名・ポートをコンパイル時に求める）
+constexpr bool urlHasPrefix(const char* s, const char* prefix) {
+    return *prefix == '\0' || (*s == *prefix && urlHasPrefix(s + 1, prefix + 1));
+}
+constexpr size_t urlSchemeLength(const char* url) {
+    return urlHasPrefix(url, "https://") ? 8 : urlHasPrefix(url, "http://") ? 7 : 0;
+}
+constexpr size_t urlHostLength(const char* host) {
+    return (*host == '\0' || *host == '/' || *host == ':') ? 0 : 1 + urlHostLength(host + 1);
+}
+constexpr uint32_t urlParseDigits(const char* s, uint32_t value) {
+    return (*s >= '0' && *s <= '9') ? urlParseDigits(s + 1, value * 10 + (*s - '0')) : value;
+}
+constexpr uint32_t urlPort(const char* afterHost) {
+    return *afterHost == ':' ? urlParseDigits(afterHost + 1, 0) : 443;
+}
+
+// HTTPのDateヘッダー（"Tue, 14 Oct 2025 03:04:05 GMT"）をUNIX時刻に変換
+inline bool parseHttpDate(const char* value, time_t& epoch) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char monthName[4];
+    int day, year, hour, minute, second;
+    if (sscanf(value, "%*3s, %d %3s %d %d:%d:%d", &day, monthName, &year, &hour, &minute, &second) != 6) {
+        return false;
+    }
+    const char* found = strstr(months, monthName);
+    if (found == nullptr || (found - months) % 3 != 0) {
+        return false;
+    }
+    int month = (found - months) / 3 + 1;
+
+    // 暦日からの通算日数（グレゴリオ暦、1970-01-01 = 0）
+    int y = year - (month <= 2);
+    int era = y / 400;
+    int yearOfEra = y - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    long days = (long)era * 146097 + dayOfEra - 719468;
+    epoch = (time_t)days * 86400 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+// フラットなJSONから数値を取り出す（"key": 123 形式のみ対応）
+inline bool jsonGetInt(const char* json, const char* key, long& value) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    const char* p = strstr(json, pattern);
+    if (p == nullptr) return false;
+    p += strlen(pattern);
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p != ':') return false;
+    p++;
+    char* end;
+    value = strtol(p, &end, 10);
+    return end != p;
+}
+
+// フラットなJSONから文字列を取り出す（エスケープ非対応）
+inline bool jsonGetString(const char* json, const char* key, char* out, size_t outSize) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    const char* p = strstr(json, pattern);
+    if (p == nullptr) return false;
+    p += strlen(pattern);
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p != ':') return false;
+    p++;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p != '"') return false;
+    p++;
+    const char* end = strchr(p, '"');
+    if (end == nullptr || (size_t)(end - p) >= outSize) return false;
+    memcpy(out, p, end - p);
+    out[end - p] = '\0';
+    return true;
+}
+
+// 16進のSHA-256（カンマ区切り）を解析し、読めたピンの数を返す（-1 = 不正な項目あり）
+inline int parseSpkiPins(const char* text, uint8_t pins[][32], int maxPins) {
+    int count = 0;
+    const char* p = text;
+
+    while (*p != '\0' && count < maxPins) {
+        while (*p == ',' || *p == ' ') p++;
+        if (*p == '\0') break;
+
+        uint8_t* pin = pins[count];
+        int digits = 0;
+        while (isxdigit((unsigned char)*p) && digits < 64) {
+            char c = tolower(*p++);
+            uint8_t nibble = c <= '9' ? c - '0' : c - 'a' + 10;
+            if (digits % 2 == 0) {
+                pin[digits / 2] = nibble << 4;
+            } else {
+                pin[digits / 2] |= nibble;
+            }
+            digits++;
+        }
+        if (digits != 64 || (*p != '\0' && *p != ',' && *p != ' ')) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+// 4画素ずつ32bitワード単位で差分絶対値の合計を計算（画素値は7bit）
+// 各バイトに 128 + a - b を作るとレーン間の桁借りが起きず、最上位bitが a >= b を示す
+inline uint32_t sumAbsDiff7(const uint32_t* a, const uint32_t* b, int words) {
+    const uint32_t HIGH_BITS = 0x80808080;
+    const uint32_t LOW_BITS = 0x7F7F7F7F;
+    uint32_t total = 0;
+    int i = 0;
+    while (i < words) {
+        // 16bitレーンの累積（1ワードあたり最大254）が溢れない単位で区切る
+        int blockEnd = words < i + 128 ? words : i + 128;
+        uint32_t lanes = 0;
+        for (; i < blockEnd; i++) {
+            uint32_t ab = (a[i] | HIGH_BITS) - b[i];
+            uint32_t ba = (b[i] | HIGH_BITS) - a[i];
+            uint32_t geq = ((ab & HIGH_BITS) >> 7) * 0xFF;
+            uint32_t diff = ((ab & geq) | (ba & ~geq)) & LOW_BITS;
+            lanes += (diff & 0x00FF00FF) + ((diff >> 8) & 0x00FF00FF);
+        }
+        total += (lanes & 0xFFFF) + (lanes >> 16);
+    }
+    return total;
+}
+
+// 指数バックオフの待機時間（base × 2^attempt を上限で打ち切り、その1/2〜1倍の一様乱数）
+inline unsigned long backoffDelayMs(int attempt, unsigned long baseMs, unsigned long maxMs,
+                                    uint32_t randomValue) {
+    unsigned long delayMs = baseMs;
+    for (int i = 0; i < attempt && delayMs < maxMs; i++) {
+        delayMs *= 2;
+    }
+    delayMs = delayMs < maxMs ? delayMs : maxMs;
+    return delayMs / 2 + randomValue % (delayMs / 2 + 1);
+}
+
+// 撮影枠内での端末ごとのオフセット（秒）。台数が多くても送信が枠の先頭に集中しない
+inline uint32_t slotOffsetSec(uint32_t deviceHash, uint32_t interval, uint32_t spreadSec) {
+    uint32_t spread = spreadSec < interval ? spreadSec : interval;
+    return spread > 0 ? deviceHash % spread : 0;
+}
+
+// 壁時計の撮影枠（区切り＋端末ごとのオフセット）のうち now より後の最初の枠
+// 撮影直後にDateヘッダー・SNTPで時刻が戻ると、撮影したばかりの枠が数秒後の枠として返るため、
+// 撮影直後は半周期未満しか離れていない枠を飛ばす
+inline time_t nextShotSlot(time_t now, time_t interval, time_t offset, bool afterShot) {
+    time_t next = ((now - offset) / interval + 1) * interval + offset;
+    if (afterShot && next - now < interval / 2) {
+        next += interval;
+    }
+    return next;
+}
+
+// レスポンスのボディとETagの格納先（リモート設定の取得用）
+struct ResponseCapture {
+    char* body;
+    size_t bodySize;
+    size_t bodyLength;
+    char etag[64];
+    char location[192];   // Location ヘッダー（再開可能アップロードのURL）
+    long uploadOffset;    // Upload-Offset ヘッダー（-1 = なし）
+    bool bodyTruncated;   // 本文が body に収まらず切り詰めた
+};
+
+// HTTPレスポンスの逐次パーサー（固定長バッファのみ使用、ヒープ確保なし）
+struct HttpResponseParser {
+    enum State { STATUS_LINE, HEADERS, BODY, DONE, FAILED };
+    State state;
+    char line[192];          // ヘッダー1行分（長すぎる行は切り詰め）
+    size_t lineLength;
+    int statusCode;
+    long contentLength;      // -1 = 不明
+    long bodyRemaining;
+    bool keepAlive;
+    bool chunked;
+    bool headRequest;        // HEADへの応答はボディなし
+    long retryAfterSec;      // Retry-After ヘッダー（秒、-1 = なし）
+    char date[40];           // Date ヘッダー（時刻補正用、空 = なし）
+    ResponseCapture* capture;
+    char errorBody[128];     // エラー時にログ出力するボディ先頭
+    size_t errorBodyLength;
+};
+
+// パーサーを初期状態に戻す
+inline void resetResponseParser(HttpResponseParser& parser, ResponseCapture* capture, bool headRequest) {
+    parser.state = HttpResponseParser::STATUS_LINE;
+    parser.lineLength = 0;
+    parser.statusCode = 0;
+    parser.contentLength = -1;
+    parser.bodyRemaining = 0;
+    parser.keepAlive = true;
+    parser.chunked = false;
+    parser.headRequest = headRequest;
+    parser.retryAfterSec = -1;
+    parser.date[0] = '\0';
+    parser.capture = capture;
+    if (capture != nullptr) {
+        capture->location[0] = '\0';
+        capture->uploadOffset = -1;
+        capture->bodyTruncated = false;
+    }
+    parser.errorBodyLength = 0;
+}
+
+// ヘッダー名を大文字小文字を区別せず比較し、一致すれば値の先頭を返す
+inline const char* matchHeader(const char* line, const char* name) {
+    size_t nameLength = strlen(name);
+    if (strncasecmp(line, name, nameLength) != 0) {
+        return nullptr;
+    }
+    const char* value = line + nameLength;
+    while (*value == ' ' || *value == '\t') value++;
+    return value;
+}
+
+// 1行分（CRLF除去済み）を解析
+inline void parseResponseLine(HttpResponseParser& parser) {
+    char* line = parser.line;
+
+    if (parser.state == HttpResponseParser::STATUS_LINE) {
+        // "HTTP/1.x NNN ..." のステータスコードが読めた時点で確定
+        if (parser.lineLength < 12 || strncmp(line, "HTTP/1.", 7) != 0) {
+            parser.state = HttpResponseParser::FAILED;
+            return;
+        }
+        parser.statusCode = atoi(line + 9);
+        if (line[7] == '0') {
+            parser.keepAlive = false;
+        }
+        parser.state = HttpResponseParser::HEADERS;
+        return;
+    }
+
+    if (parser.lineLength == 0) {
+        // 空行でヘッダー終了
+        bool noBody = parser.headRequest || parser.statusCode == 204 || parser.statusCode == 304;
+        if (noBody) {
+            parser.bodyRemaining = 0;
+        } else if (parser.chunked || parser.contentLength < 0) {
+            // chunked・長さ不明のボディは読み切りに対応しないため接続を閉じる
+            parser.keepAlive = false;
+            parser.bodyRemaining = 0;
+        } else {
+            parser.bodyRemaining = parser.contentLength;
+        }
+        parser.state = parser.bodyRemaining > 0 ? HttpResponseParser::BODY : HttpResponseParser::DONE;
+        return;
+    }
+
+    const char* value;
+    if ((value = matchHeader(line, "content-length:")) != nullptr) {
+        parser.contentLength = atol(value);
+    } else if ((value = matchHeader(line, "connection:")) != nullptr) {
+        if (strncasecmp(value, "close", 5) == 0) {
+            parser.keepAlive = false;
+        }
+    } else if ((value = matchHeader(line, "transfer-encoding:")) != nullptr) {
+        parser.chunked = true;
+    } else if ((value = matchHeader(line, "date:")) != nullptr) {
+        strncpy(parser.date, value, sizeof(parser.date) - 1);
+        parser.date[sizeof(parser.date) - 1] = '\0';
+    } else if ((value = matchHeader(line, "retry-after:")) != nullptr) {
+        // 秒数の形式のみ対応（日時の形式は指示なしとして既定の待機を使う）
+        if (isdigit((unsigned char)*value)) {
+            parser.retryAfterSec = atol(value);
+        }
+    } else if (parser.capture == nullptr) {
+        return;
+    } else if ((value = matchHeader(line, "etag:")) != nullptr) {
+        strncpy(parser.capture->etag, value, sizeof(parser.capture->etag) - 1);
+        parser.capture->etag[sizeof(parser.capture->etag) - 1] = '\0';
+    } else if ((value = matchHeader(line, "location:")) != nullptr) {
+        strncpy(parser.capture->location, value, sizeof(parser.capture->location) - 1);
+        parser.capture->location[sizeof(parser.capture->location) - 1] = '\0';
+    } else if ((value = matchHeader(line, "upload-offset:")) != nullptr) {
+        parser.capture->uploadOffset = atol(value);
+    }
+}
+
+// 受信バイト列を解析し、消費したバイト数を返す
+// レスポンスの終端（DONE）で止まるため、残りは後続レスポンスのバイトとして残す
+inline size_t feedResponseParser(HttpResponseParser& parser, const uint8_t* data, size_t len) {
+    size_t consumed = 0;
+
+    while (consumed < len &&
+           parser.state != HttpResponseParser::DONE && parser.state != HttpResponseParser::FAILED) {
+        if (parser.state == HttpResponseParser::BODY) {
+            size_t chunk = len - consumed;
+            if ((size_t)parser.bodyRemaining < chunk) chunk = parser.bodyRemaining;
+            const uint8_t* bodyData = data + consumed;
+
+            if (parser.capture != nullptr && parser.capture->body != nullptr) {
+                ResponseCapture* capture = parser.capture;
+                size_t copyLength = capture->bodySize - 1 - capture->bodyLength;
+                if (chunk < copyLength) copyLength = chunk;
+                if (copyLength < chunk) capture->bodyTruncated = true;
+                memcpy(capture->body + capture->bodyLength, bodyData, copyLength);
+                capture->bodyLength += copyLength;
+                capture->body[capture->bodyLength] = '\0';
+            }
+            if (parser.statusCode >= 300) {
+                size_t copyLength = sizeof(parser.errorBody) - 1 - parser.errorBodyLength;
+                if (chunk < copyLength) copyLength = chunk;
+                memcpy(parser.errorBody + parser.errorBodyLength, bodyData, copyLength);
+                parser.errorBodyLength += copyLength;
+            }
+
+            consumed += chunk;
+            parser.bodyRemaining -= chunk;
+            if (parser.bodyRemaining == 0) {
+                parser.state = HttpResponseParser::DONE;
+            }
+            continue;
+        }
+
+        char c = (char)data[consumed++];
+        if (c == '\n') {
+            if (parser.lineLength > 0 && parser.line[parser.lineLength - 1] == '\r') {
+                parser.lineLength--;
+            }
+            parser.line[parser.lineLength] = '\0';
+            parseResponseLine(parser);
+            parser.lineLength = 0;
+        } else if (parser.lineLength < sizeof(parser.line) - 1) {
+            parser.line[parser.lineLength++] = c;
+        }
+    }
+
+    return consumed;
+}
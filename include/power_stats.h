@@ -0,0 +1,42 @@
+// 処理フェーズ別の所要時間と電源管理（電池残量・消費電荷の推定と撮影間隔の調整）
+#pragma once
+
+#include <Arduino.h>
+#include "photo_util.h"
+
+// 撮影1回あたりの処理フェーズ別計測（RTCメモリに保持し、Deep sleepをまたいで集計）
+enum ShotPhase {
+    PHASE_CAMERA_INIT,  // カメラ初期化
+    PHASE_WARMUP,       // センサーの露出安定待ち
+    PHASE_CAPTURE,      // フレーム取得
+    PHASE_WIFI,         // WiFi接続
+    PHASE_TLS,          // TLSハンドシェイク
+    PHASE_SEND,         // ヘッダー・ボディ送信
+    PHASE_RESPONSE,     // レスポンス待ち
+    PHASE_AWAKE,        // 起動からDeep sleepまでの稼働時間
+    PHASE_COUNT
+};
+extern PhaseStats phaseStats[PHASE_COUNT];
+
+// 電源管理（フェーズ時間から1撮影あたりの消費電荷を推定し、目標稼働日数に合わせて撮影間隔を調整）
+struct PowerState {
+    int16_t batteryMv;         // 0 = 未計測
+    int8_t batteryLevel;       // -1 = 未計測
+    uint32_t shotUAh;          // 1撮影サイクルあたりの推定消費（µAh、指数移動平均）
+    uint32_t pendingCameraMs;  // 前回の推定以降に記録したフェーズ時間
+    uint32_t pendingRadioMs;
+    uint32_t pendingAwakeMs;
+    time_t targetEndEpoch;     // 目標稼働期間の終わり（満充電時に設定、0 = 未設定）
+    uint32_t intervalSec;      // 調整後の撮影間隔（0 = 設定値のまま）
+};
+
+void recordPhase(ShotPhase phase, int64_t startUs);
+void formatPhaseSummary(char* out, size_t outSize);
+void samplePower();
+PowerState powerSnapshot();
+void updatePowerBudget();
+bool shouldDeferUploads();
+bool isBatteryReadingValid();
+uint32_t effectiveIntervalSec();
+void formatPowerSummary(char* out, size_t outSize);
+void printPhaseStats();
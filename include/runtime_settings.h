@@ -0,0 +1,26 @@
+// 実行時設定（NVSに保存し、リモート設定で更新）
+#pragma once
+
+#include <Arduino.h>
+
+// 実行時設定（NVSに保存、リモート設定で更新。保存されていない項目はconfig.hの値）
+struct RuntimeSettings {
+    uint32_t photoIntervalSec;
+    char bucket[64];
+    uint8_t encoderBestLevel;
+    uint32_t uploadChunkSize;
+    uint8_t maxWifiRetry;
+    uint32_t lightSleepMs;
+    uint32_t awakeGraceMs;
+    uint8_t motionThreshold;
+};
+extern RuntimeSettings settings;
+extern uint32_t lastConfigCheckEpoch;  // 前回リモート設定を確認した時刻（RTCメモリ）
+
+void loadEnvironmentVariables();
+void loadRuntimeSettings();
+void sanitizeRuntimeSettings();
+bool saveRuntimeSettings();
+unsigned long photoIntervalMs();
+bool applyRemoteConfig(const char* json);
+void maybeFetchRemoteConfig();
@@ -0,0 +1,13 @@
+// 撮影スケジュールと撮影間のスリープ（壁時計の区切りへの整列・Light sleep・Deep sleep）
+#pragma once
+
+#include <Arduino.h>
+
+void enterLightSleep();
+void scheduleNextShot(bool afterShot = false);
+void alignShotSchedule(bool afterShot = false);
+bool isShotDue();
+uint32_t deviceHash();
+uint32_t fleetSlotOffsetSec(uint32_t interval);
+unsigned long millisUntilNextShot();
+void enterTimerDeepSleep();
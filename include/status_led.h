@@ -0,0 +1,20 @@
+// ステータスLED
+#pragma once
+
+#include <Arduino.h>
+
+// LED点滅パターン（LEDタスクが順に再生し、呼び出し側は待たない）
+struct LedCommand {
+    uint8_t blinks;   // 点滅回数（0 = 点灯・消灯の切り替えのみ）
+    bool on;          // blinks == 0 の時の状態
+    uint16_t onMs;
+    uint16_t offMs;
+};
+
+bool startLedTask();
+void ledTask(void* param);
+void runLedCommand(const LedCommand& command);
+void postLedCommand(const LedCommand& command);
+void ledSet(bool on);
+void ledBlink(uint8_t blinks, uint16_t onMs, uint16_t offMs);
+void waitForLedIdle();
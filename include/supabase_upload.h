@@ -0,0 +1,60 @@
+// Supabase Storage へのアップロード（keep-alive接続・パイプライン送信・再開可能アップロード・通知）
+#pragma once
+
+#include <Arduino.h>
+#include "app_config.h"
+#include "tls_client.h"
+
+// 認証など値が固定のヘッダーはプリプロセッサで1つの定数にまとめる（Hostのみ起動時に埋め込む）
+constexpr char SUPABASE_AUTH_HEADER[] = "Authorization: Bearer " SUPABASE_SERVICE_KEY "\r\n";
+constexpr char UPLOAD_STATIC_HEADERS[] =
+    "Authorization: Bearer " SUPABASE_SERVICE_KEY "\r\n"
+    "Content-Type: image/jpeg\r\n"
+    "x-upsert: true\r\n"
+    "Connection: keep-alive\r\n";
+
+// 再開可能アップロード（tus）の進捗。キュー内のフレームは /queue/<seq>.tus に保存
+struct ResumableUpload {
+    uint32_t queueSeq;     // オフラインキューの連番（0 = キュー外）
+    uint32_t offset;       // サーバーが受信確認したバイト数
+    char location[192];    // アップロードURLのパス（空 = 未作成）
+};
+
+// アップロード対象1件（バッチ送信の単位）
+struct UploadItem {
+    const uint8_t* data;
+    size_t size;
+    const char* filename;
+    int statusCode;   // HTTPステータス（0 = 未送信・通信エラー）
+    ResumableUpload* resume; // 再開可能アップロードの進捗（nullptr = 通常のPOSTのみ）
+};
+
+extern SessionTlsClient uploadClient;
+extern bool uploadClientOpen;
+extern unsigned int uploadClientRequests;
+extern char supabaseHost[64];
+extern uint16_t supabasePort;
+extern char uploadRequestBuffer[1024];
+extern int lastUploadStatusCode; // 直近のアップロードのHTTPステータス（0 = 通信エラー）
+extern time_t serverBackoffUntilEpoch;  // サーバー指示による送信停止の期限（RTCメモリ）
+
+bool uploadPhotoToSupabase(uint8_t* imageData, size_t imageSize, const char* filename);
+bool initUploadRequestTemplate();
+bool openUploadConnection();
+bool ensureUploadConnection(bool& reused);
+void closeUploadConnection();
+int readUploadResponse(ResponseCapture* capture = nullptr, bool headRequest = false);
+bool waitForUploadData(unsigned long timeoutMs);
+size_t sendUploadBody(const uint8_t* data, size_t len);
+int uploadBatchToSupabase(UploadItem* items, int count);
+bool sendUploadRequest(const UploadItem& item, const char* extraHeaders);
+int buildUploadRequest(const char* filename, size_t imageSize, const char* extraHeaders);
+bool uploadLogTail(const char* photoFilename);
+int formatPhotoNotifyBody(const UploadItem* items, int count);
+bool notifyUploadedPhotos(const UploadItem* items, int count);
+bool isResumableItem(const UploadItem& item);
+int uploadResumable(UploadItem& item);
+int sendResumableRequest(const char* method, const char* path, const char* headers,
+                         const uint8_t* body, size_t bodyLength, ResponseCapture& capture);
+void noteServerBusy(long retryAfterSec);
+bool isServerBackingOff();
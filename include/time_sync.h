@@ -0,0 +1,16 @@
+// 時刻管理（アップロード応答のDateヘッダーで補正し、SNTPは必要な時のみ）
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+extern std::atomic<bool> sntpSyncDone;  // SNTP同期完了（メインループで停止する）
+
+void getFormattedTimestamp(char* out, size_t outSize);
+bool isTimeValid();
+void applyTimeZone();
+void applyTimeStep(time_t delta);
+void syncTimeFromHttpDate(const char* value);
+void sntpSyncCallback(struct timeval* tv);
+void maybeStartSntp();
+void stopSntp();
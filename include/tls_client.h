@@ -0,0 +1,21 @@
+// TLS接続（ルート証明書によるチェーン検証・公開鍵ピンニング・セッション再開）
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+
+// TLSセッションの保存・再開に対応した WiFiClientSecure
+// 標準の connect() はソケット接続からハンドシェイクまでを一括で行い、保存したセッションを渡す手段がないため、
+// 同じ手順（フレームワークの start_ssl_client）をここで行い、ハンドシェイク前に mbedtls_ssl_set_session を呼ぶ
+class SessionTlsClient : public WiFiClientSecure {
+public:
+    int connectWithSession(IPAddress ip, uint16_t port, const char* host);
+    void saveSession();
+};
+
+extern size_t tlsSessionLength;  // 保存したTLSセッションの長さ（0 = 保存なし）
+
+bool initCertificatePins();
+bool verifyServerPin();
+bool loadRootCaChain();
+int tlsVerifyCallback(void* context, mbedtls_x509_crt* crt, int depth, uint32_t* flags);
@@ -0,0 +1,11 @@
+// WiFi接続（前回のAPへの高速接続・固定IP・失敗時の再試行）
+#pragma once
+
+#include <Arduino.h>
+
+extern const char* ssid;
+
+bool connectToWiFi();
+bool connectToWiFiLocked();
+bool waitForWiFiConnection(unsigned long timeoutMs);
+void applyStaticIpConfig();
@@ -0,0 +1,162 @@
+#include "app_log.h"
+
+RTC_NOINIT_ATTR LogRing logRing;
+TaskHandle_t logTaskHandle = NULL;
+std::atomic<uint32_t> logDropped(0);  // 書き出し前に上書きされた行数
+char* logTailBuffer = nullptr;
+
+// ログリングの初期化（電源投入時・内容が壊れている場合のみ消去し、それ以外は前回の続きから使う）
+void initLogRing(esp_reset_reason_t resetReason) {
+    uint32_t writeIndex = logRing.writeIndex.load();
+    uint32_t flushIndex = logRing.flushIndex.load();
+    if (resetReason == ESP_RST_POWERON || logRing.magic != LOG_MAGIC ||
+        writeIndex - flushIndex > LOG_RING_RECORDS || writeIndex - logRing.tailIndex > 0x80000000UL) {
+        logRing.writeIndex = 0;
+        logRing.flushIndex = 0;
+        logRing.tailIndex = 0;
+        logRing.tailPending = false;
+        for (int i = 0; i < LOG_RING_RECORDS; i++) {
+            logRing.records[i].seq = 0;
+        }
+        logRing.magic = LOG_MAGIC;
+        return;
+    }
+    
+    // 書き込み途中で止まった行は書き出さない
+    for (uint32_t i = flushIndex; i != writeIndex; i++) {
+        LogRecord& record = logRing.records[i & (LOG_RING_RECORDS - 1)];
+        if (record.seq.load() != i + 1) {
+            record.seq.store(LOG_SEQ_DISCARDED);
+        }
+    }
+}
+
+// 1行を整形してリングに書き込む（UARTへの出力は待たない）
+void logWrite(int level, const char* format, ...) {
+    // 満杯ならログタスクの書き出しを少し待ち、それでも空かなければ最も古い行を上書き
+    for (int waited = 0; waited < LOG_FULL_WAIT_MS && logTaskHandle != NULL &&
+                         xTaskGetCurrentTaskHandle() != logTaskHandle; waited++) {
+        if (logRing.writeIndex.load(std::memory_order_relaxed) -
+            logRing.flushIndex.load(std::memory_order_acquire) < LOG_RING_RECORDS) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    
+    uint32_t index = logRing.writeIndex.fetch_add(1, std::memory_order_relaxed);
+    LogRecord& record = logRing.records[index & (LOG_RING_RECORDS - 1)];
+    record.seq.store(0, std::memory_order_relaxed);
+    record.ms = millis();
+    record.level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record.text, sizeof(record.text), format, args);
+    va_end(args);
+    record.seq.store(index + 1, std::memory_order_release);
+    
+    if (level <= LOG_LEVEL_WARN) {
+        logRing.tailPending = true;
+    }
+    if (logTaskHandle != NULL) {
+        xTaskNotifyGive(logTaskHandle);
+    }
+}
+
+// ログの書き出しは最低優先度のタスクで行う（シリアル送信で撮影・アップロードを待たせない）
+bool startLogTask() {
+    if (xTaskCreatePinnedToCore(logTask, "log", 3072, NULL, 0, &logTaskHandle, 1) != pdPASS) {
+        logTaskHandle = NULL;
+        return false;
+    }
+    return true;
+}
+
+void logTask(void* param) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        drainLogRing();
+    }
+}
+
+// 書き込みが完了した行を順にシリアルへ出力（ログタスクのみ呼ぶ。タスクがない場合は呼び出し元）
+void drainLogRing() {
+    char text[LOG_TEXT_SIZE];
+    uint32_t flushIndex = logRing.flushIndex.load(std::memory_order_relaxed);
+    
+    for (;;) {
+        uint32_t writeIndex = logRing.writeIndex.load(std::memory_order_acquire);
+        if (flushIndex == writeIndex) {
+            break;
+        }
+        if (writeIndex - flushIndex > LOG_RING_RECORDS) {
+            logDropped += writeIndex - LOG_RING_RECORDS - flushIndex;
+            flushIndex = writeIndex - LOG_RING_RECORDS;
+        }
+        
+        LogRecord& record = logRing.records[flushIndex & (LOG_RING_RECORDS - 1)];
+        uint32_t seq = record.seq.load(std::memory_order_acquire);
+        if (seq != flushIndex + 1 && seq != LOG_SEQ_DISCARDED && writeIndex - flushIndex <= LOG_RING_RECORDS) {
+            break; // 書き込み中（完了時に再び通知される）
+        }
+        if (seq == flushIndex + 1) {
+            memcpy(text, record.text, sizeof(text));
+            text[sizeof(text) - 1] = '\0';
+            // コピー中に上書きされていなければ出力
+            if (record.seq.load(std::memory_order_acquire) == seq) {
+                Serial.println(text);
+            }
+        }
+        flushIndex++;
+        logRing.flushIndex.store(flushIndex, std::memory_order_release);
+    }
+    
+    uint32_t dropped = logDropped.exchange(0);
+    if (dropped > 0) {
+        Serial.printf("[LOG] %lu line(s) dropped\n", (unsigned long)dropped);
+    }
+}
+
+// スリープ・再起動の前にリングの内容をすべて出力し、UARTの送信完了を待つ
+void logFlush() {
+    if (logTaskHandle == NULL) {
+        drainLogRing();
+    } else {
+        for (int waited = 0; waited < 500; waited += 5) {
+            if (logRing.flushIndex.load() == logRing.writeIndex.load()) {
+                break;
+            }
+            xTaskNotifyGive(logTaskHandle);
+            vTaskDelay(pdMS_TO_TICKS(5));
+        }
+    }
+    Serial.flush();
+}
+
+// 前回のログ送信以降の行を "経過ミリ秒 レベル 本文" の形式で出力し、長さを返す
+size_t formatLogTail(char* out, size_t outSize, uint32_t& endIndex) {
+    static const char LEVEL_CHARS[] = "?EWID";
+    uint32_t writeIndex = logRing.writeIndex.load(std::memory_order_acquire);
+    uint32_t index = logRing.tailIndex;
+    if (writeIndex - index > LOG_RING_RECORDS) {
+        index = writeIndex - LOG_RING_RECORDS;
+    }
+    
+    size_t length = 0;
+    out[0] = '\0';
+    for (; index != writeIndex; index++) {
+        LogRecord& record = logRing.records[index & (LOG_RING_RECORDS - 1)];
+        if (record.seq.load(std::memory_order_acquire) != index + 1) {
+            continue;
+        }
+        int n = snprintf(out + length, outSize - length, "%lu %c %.*s\n", (unsigned long)record.ms,
+                         LEVEL_CHARS[record.level <= LOG_LEVEL_DEBUG ? record.level : 0],
+                         LOG_TEXT_SIZE - 1, record.text);
+        if (n < 0 || (size_t)n >= outSize - length) {
+            out[length] = '\0';
+            break;
+        }
+        length += n;
+    }
+    endIndex = index;
+    return length;
+}
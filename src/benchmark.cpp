@@ -0,0 +1,86 @@
+#include "benchmark.h"
+#include "M5TimerCAM.h"
+#include "esp_timer.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+#include "camera_capture.h"
+#include "supabase_upload.h"
+
+#if BENCHMARK_MODE
+// 撮影とアップロードを繰り返し、スループット・ハンドシェイク時間・ヒープ最小値を計測
+// BENCH_KEEPALIVE 0 で毎回接続を閉じ、TLS再利用の効果を比較できる
+void runBenchmark() {
+    LOG_I("[BENCH] Starting benchmark");
+    LOG_I("[BENCH] Target: %s:%u", supabaseHost, supabasePort);
+    LOG_I("[BENCH] Iterations: %d, chunk size: %lu, keep-alive: %s", BENCH_ITERATIONS, (unsigned long)settings.uploadChunkSize, BENCH_KEEPALIVE ? "on" : "off");
+    
+    portENTER_CRITICAL(&stateMux);
+    memset(phaseStats, 0, sizeof(phaseStats));
+    portEXIT_CRITICAL(&stateMux);
+    
+    int framesCaptured = 0;
+    int framesUploaded = 0;
+    uint64_t bytesUploaded = 0;
+    int64_t captureUs = 0;
+    int64_t uploadUs = 0;
+    uint32_t minMaxAlloc = ESP.getMaxAllocHeap();
+    int64_t benchStart = esp_timer_get_time();
+    
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        int64_t start = esp_timer_get_time();
+        if (!takePhoto()) {
+            continue;
+        }
+        captureUs += esp_timer_get_time() - start;
+        framesCaptured++;
+        
+        char filename[48];
+        snprintf(filename, sizeof(filename), "bench_%03d.jpg", i);
+        
+        start = esp_timer_get_time();
+        if (uploadPhotoToSupabase(TimerCAM.Camera.fb->buf, TimerCAM.Camera.fb->len, filename)) {
+            uploadUs += esp_timer_get_time() - start;
+            bytesUploaded += TimerCAM.Camera.fb->len;
+            framesUploaded++;
+        }
+        TimerCAM.Camera.free();
+        
+        if (!BENCH_KEEPALIVE) {
+            closeUploadConnection();
+        }
+        if (ESP.getMaxAllocHeap() < minMaxAlloc) {
+            minMaxAlloc = ESP.getMaxAllocHeap();
+        }
+    }
+    
+    int64_t totalUs = esp_timer_get_time() - benchStart;
+    
+    LOG_I("[BENCH] ===== Results =====");
+    LOG_I("[BENCH] Frames: %d captured, %d uploaded", framesCaptured, framesUploaded);
+    LOG_I("[BENCH] Overall: %.2f frames/s", framesUploaded * 1e6 / (double)totalUs);
+    if (framesCaptured > 0) {
+        LOG_I("[BENCH] Capture: %.1f ms/frame", captureUs / 1000.0 / framesCaptured);
+    }
+    if (uploadUs > 0) {
+        LOG_I("[BENCH] Upload: %.1f KB/s (%.1f ms/frame)",
+              bytesUploaded / 1024.0 / (uploadUs / 1e6), uploadUs / 1000.0 / framesUploaded);
+    }
+    portENTER_CRITICAL(&stateMux);
+    PhaseStats tls = phaseStats[PHASE_TLS];
+    portEXIT_CRITICAL(&stateMux);
+    if (tls.count > 0) {
+        LOG_I("[BENCH] TLS handshake: %lu ms avg over %lu connection(s)",
+              (unsigned long)(tls.avgUs / 1000), (unsigned long)tls.count);
+    }
+    LOG_I("[BENCH] Heap: min free %lu, min largest block %lu",
+          (unsigned long)ESP.getMinFreeHeap(), (unsigned long)minMaxAlloc);
+    LOG_I("[BENCH] Loop task stack high-water mark: %lu",
+          (unsigned long)uxTaskGetStackHighWaterMark(NULL));
+    printPhaseStats();
+    LOG_I("[BENCH] ===== Done =====");
+}
+
+#endif
@@ -0,0 +1,423 @@
+#include "camera_capture.h"
+#include <WiFi.h>
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+#include "time_sync.h"
+#include "capture_pipeline.h"
+#include "local_stream.h"
+
+const uint32_t ENCODER_MIN_BUDGET = 15000;  // バイト予算の下限
+
+RTC_DATA_ATTR EncoderState encoderState = {ENCODER_DEFAULT_LEVEL, 0, 0, 0};
+int appliedEncoderLevel = -1;  // センサーに設定済みの段階（カメラ初期化ごとに再設定）
+
+// 最後に安定した露出・ゲイン（OV3660のレジスタ値、タイマー復帰時の初期値に使う）
+struct SensorExposure {
+    bool valid;
+    uint32_t exposure;  // 0x3500-0x3502（1/16ライン単位）
+    uint16_t gain;      // 0x350A-0x350B
+};
+RTC_DATA_ATTR SensorExposure savedExposure = {false, 0, 0};
+bool sensorWarm = false;  // カメラ起動後に露出が安定したか
+
+// 変化検出用の縮小グレースケール参照画像（最後にアップロードしたフレーム）
+// 画素値は7bit（0〜127）で保持し、4画素を1ワードにまとめて比較する
+#if MOTION_DETECTION
+const int MOTION_GRID_WIDTH = 40;
+const int MOTION_GRID_HEIGHT = 30;
+const int MOTION_GRID_WORDS = MOTION_GRID_WIDTH * MOTION_GRID_HEIGHT / 4;
+struct MotionReference {
+    bool valid;
+    uint16_t skippedCount;
+    uint32_t pixels[MOTION_GRID_WORDS];
+};
+RTC_DATA_ATTR MotionReference motionRef;  // 無効時はRTCメモリを使わない
+#endif
+
+struct ThumbnailWriter {
+    uint8_t* out;
+    size_t size;
+    size_t length;
+};
+
+uint8_t* decodeBuffer = nullptr;
+size_t decodeBufferSize = 0;
+
+// エンコーダー状態の一貫したコピー
+EncoderState encoderSnapshot() {
+    portENTER_CRITICAL(&stateMux);
+    EncoderState snapshot = encoderState;
+    portEXIT_CRITICAL(&stateMux);
+    return snapshot;
+}
+
+// 写真撮影関数
+bool takePhoto() {
+    // メモリチェック
+    // 空き容量の合計ではなく最大連続ブロックで判定（断片化していると合計は当てにならない）
+    if (ESP.getMaxAllocHeap() < HEAP_MIN_BLOCK) {
+        LOG_E("[SAFETY] Insufficient memory for camera operation");
+        sampleHeapTrend();
+        return false;
+    }
+    
+    // 撮影ごとに電池を計測し、撮影間隔を見直す（撮り直しでは繰り返さない）
+    updatePowerBudget();
+    
+    for (;;) {
+#if ADAPTIVE_ENCODER
+        selectEncoderLevel();
+#endif
+        
+        // カメラ起動直後は露出が安定したフレームを待つ
+        bool result;
+        if (!sensorWarm) {
+            result = captureAfterWarmUp();
+        } else {
+            int64_t captureStart = esp_timer_get_time();
+            result = TimerCAM.Camera.get();
+            if (result) {
+                recordPhase(PHASE_CAPTURE, captureStart);
+            }
+        }
+        
+        if (!result) {
+            LOG_E("[ERROR] Photo capture failed!");
+            return false;
+        }
+        
+        // フレームサイズの妥当性チェック
+        if (TimerCAM.Camera.fb->len == 0) {
+            LOG_E("[SAFETY] Invalid frame size (0 bytes)");
+            TimerCAM.Camera.free();
+            return false;
+        }
+        
+        if (TimerCAM.Camera.fb->len > MAX_FRAME_SIZE) {
+            LOG_E("[SAFETY] Frame too large, may cause memory issues");
+            TimerCAM.Camera.free();
+#if ADAPTIVE_ENCODER
+            // 破棄せず1段階下げて撮り直す（最低段階まで。配信中は段階を変えないため撮り直さない）
+            if (encoderSnapshot().level < ENCODER_LEVEL_COUNT - 1 && !localStreamActive) {
+                portENTER_CRITICAL(&stateMux);
+                encoderState.lastFrameBytes = MAX_FRAME_SIZE + 1;
+                portEXIT_CRITICAL(&stateMux);
+                continue;
+            }
+#endif
+            return false;
+        }
+        
+        // バッファの妥当性チェック
+        if (TimerCAM.Camera.fb->buf == nullptr) {
+            LOG_E("[SAFETY] Invalid buffer pointer");
+            TimerCAM.Camera.free();
+            return false;
+        }
+        
+        portENTER_CRITICAL(&stateMux);
+        encoderState.lastFrameBytes = TimerCAM.Camera.fb->len;
+        portEXIT_CRITICAL(&stateMux);
+        
+        LOG_I("[PHOTO] Photo captured - Size: %u bytes", (unsigned int)(TimerCAM.Camera.fb->len));
+        return true;
+    }
+}
+
+// OV3660の露出（AEC）・ゲイン（AGC）の現在値を読み出す
+bool readSensorExposure(uint32_t& exposure, uint16_t& gain) {
+    sensor_t* sensor = TimerCAM.Camera.sensor;
+    if (sensor->id.PID != OV3660_PID) {
+        return false;
+    }
+    int exposureHigh = sensor->get_reg(sensor, 0x3500, 0x0F);
+    int exposureMid = sensor->get_reg(sensor, 0x3501, 0xFF);
+    int exposureLow = sensor->get_reg(sensor, 0x3502, 0xF0);
+    int gainHigh = sensor->get_reg(sensor, 0x350A, 0x03);
+    int gainLow = sensor->get_reg(sensor, 0x350B, 0xFF);
+    if (exposureHigh < 0 || exposureMid < 0 || exposureLow < 0 || gainHigh < 0 || gainLow < 0) {
+        return false;
+    }
+    exposure = ((uint32_t)exposureHigh << 16) | ((uint32_t)exposureMid << 8) | (uint32_t)exposureLow;
+    gain = ((uint16_t)gainHigh << 8) | (uint16_t)gainLow;
+    return true;
+}
+
+// 前回安定した露出・ゲインを書き込み、AEC/AGCをそこから再開させる
+void restoreSensorExposure() {
+    sensor_t* sensor = TimerCAM.Camera.sensor;
+    if (!savedExposure.valid || sensor->id.PID != OV3660_PID) {
+        return;
+    }
+    sensor->set_exposure_ctrl(sensor, 0);
+    sensor->set_gain_ctrl(sensor, 0);
+    sensor->set_reg(sensor, 0x3500, 0x0F, (savedExposure.exposure >> 16) & 0x0F);
+    sensor->set_reg(sensor, 0x3501, 0xFF, (savedExposure.exposure >> 8) & 0xFF);
+    sensor->set_reg(sensor, 0x3502, 0xF0, savedExposure.exposure & 0xF0);
+    sensor->set_reg(sensor, 0x350A, 0x03, (savedExposure.gain >> 8) & 0x03);
+    sensor->set_reg(sensor, 0x350B, 0xFF, savedExposure.gain & 0xFF);
+    sensor->set_exposure_ctrl(sensor, 1);
+    sensor->set_gain_ctrl(sensor, 1);
+    
+    LOG_I("[CAMERA] Restored exposure %lu, gain %u", (unsigned long)savedExposure.exposure, savedExposure.gain);
+}
+
+// 露出が安定するまでフレームを取得し、安定したフレームをそのまま撮影結果にする
+// 判定はOV3660では露出×ゲインのレジスタ値、それ以外はJPEGサイズ（明るさの目安）
+bool captureAfterWarmUp() {
+    int64_t warmupStart = esp_timer_get_time();
+    uint32_t previous = 0;
+    int stableFrames = 0;
+    
+    for (int frame = 0; frame < WARMUP_MAX_FRAMES; frame++) {
+        if (!TimerCAM.Camera.get()) {
+            return false;
+        }
+        
+        uint32_t exposure = 0;
+        uint16_t gain = 0;
+        bool haveRegisters = readSensorExposure(exposure, gain);
+        uint32_t metric = haveRegisters ? exposure * (gain + 1) : TimerCAM.Camera.fb->len;
+        
+        uint32_t delta = metric > previous ? metric - previous : previous - metric;
+        bool stable = frame > 0 && (uint64_t)delta * 100 <= (uint64_t)previous * WARMUP_TOLERANCE_PERCENT;
+        stableFrames = stable ? stableFrames + 1 : 0;
+        previous = metric;
+        
+        if (stableFrames >= WARMUP_STABLE_FRAMES || frame == WARMUP_MAX_FRAMES - 1) {
+            if (haveRegisters) {
+                savedExposure.valid = true;
+                savedExposure.exposure = exposure;
+                savedExposure.gain = gain;
+            }
+            sensorWarm = true;
+            recordPhase(PHASE_WARMUP, warmupStart);
+            
+            LOG_I("[CAMERA] Exposure %s after %d frame(s)", stableFrames >= WARMUP_STABLE_FRAMES ? "settled" : "not settled", frame + 1);
+            return true;
+        }
+        TimerCAM.Camera.free();
+    }
+    return false;
+}
+
+// 解像度と画質をセンサーに設定（解像度を変えた直後の1フレームは旧設定のため捨てる）
+void applyEncoderLevel(int level) {
+    if (level < 0 || level >= ENCODER_LEVEL_COUNT) {
+        level = ENCODER_DEFAULT_LEVEL;
+    }
+    portENTER_CRITICAL(&stateMux);
+    encoderState.level = level;
+    portEXIT_CRITICAL(&stateMux);
+    if (level == appliedEncoderLevel) {
+        return;
+    }
+    
+    const EncoderLevel& target = ENCODER_LEVELS[level];
+    bool framesizeChanged = appliedEncoderLevel >= 0 &&
+                            ENCODER_LEVELS[appliedEncoderLevel].framesize != target.framesize;
+    TimerCAM.Camera.sensor->set_framesize(TimerCAM.Camera.sensor, target.framesize);
+    TimerCAM.Camera.sensor->set_quality(TimerCAM.Camera.sensor, target.quality);
+    appliedEncoderLevel = level;
+    
+    if (framesizeChanged && TimerCAM.Camera.get()) {
+        TimerCAM.Camera.free();
+    }
+}
+
+// 電波状況・送信スループット・電池残量から1枚あたりのバイト予算を決め、
+// 直近のフレームサイズと比べて解像度と画質を1段階ずつ調整する
+void selectEncoderLevel() {
+    // 配信中は閲覧中の解像度が途中で変わらないよう固定
+    if (localStreamActive) {
+        return;
+    }
+    if (WiFi.status() == WL_CONNECTED) {
+        int8_t rssi = WiFi.RSSI();
+        portENTER_CRITICAL(&stateMux);
+        encoderState.lastRssi = rssi;
+        portEXIT_CRITICAL(&stateMux);
+    }
+    EncoderState encoder = encoderSnapshot();
+    PowerState power = powerSnapshot();
+    
+    // 目標送信時間で送れるバイト数
+    uint32_t budget = MAX_FRAME_SIZE;
+    if (encoder.throughputBps > 0) {
+        uint64_t airtimeBytes = (uint64_t)encoder.throughputBps * ENCODER_AIRTIME_TARGET_MS / 1000;
+        if (airtimeBytes < budget) budget = (uint32_t)airtimeBytes;
+    }
+    
+    // 電波が弱いと再送が増えるため予算を絞る
+    int rssi = encoder.lastRssi;
+    if (rssi != 0 && rssi < -80) {
+        budget /= 2;
+    } else if (rssi != 0 && rssi < -70) {
+        budget = budget * 3 / 4;
+    }
+    
+    // 電池残量が少ない・撮影間隔を延ばしている間は送信時間を短くする
+    int batteryLevel = power.batteryLevel >= 0 ? power.batteryLevel : 100;
+    if (batteryLevel < 20) {
+        budget /= 2;
+    } else if (batteryLevel < 40 || power.intervalSec != 0) {
+        budget = budget * 3 / 4;
+    }
+    
+    if (budget < ENCODER_MIN_BUDGET) budget = ENCODER_MIN_BUDGET;
+    
+    // 予算超過なら1段階下げ、半分以下なら1段階上げる（往復しないよう余裕を持たせる）
+    int level = encoder.level;
+    uint32_t lastBytes = encoder.lastFrameBytes;
+    if (lastBytes > budget && level < ENCODER_LEVEL_COUNT - 1) {
+        level++;
+    } else if (lastBytes > 0 && lastBytes * 2 < budget && level > settings.encoderBestLevel) {
+        level--;
+    }
+    if (level < settings.encoderBestLevel) level = settings.encoderBestLevel;
+    
+    if (level != encoder.level) {
+        LOG_I("[ENCODER] Level %d -> %d (framesize %d, quality %d), budget %lu bytes, last %lu bytes, RSSI %d, battery %d%%",
+              encoder.level, level, (int)ENCODER_LEVELS[level].framesize,
+              ENCODER_LEVELS[level].quality, (unsigned long)budget,
+              (unsigned long)lastBytes, rssi, batteryLevel);
+    }
+    applyEncoderLevel(level);
+}
+
+// 撮影フレームを1/8でデコードして縮小グレースケール化し、前回アップロード分と比較
+// 変化なしなら true。送信する場合は参照画像を今回のフレームで置き換える
+bool isSceneUnchanged(const camera_fb_t* fb) {
+#if MOTION_DETECTION
+    int64_t checkStart = esp_timer_get_time();
+    
+    size_t width = fb->width / 8;
+    size_t height = fb->height / 8;
+    if (width < (size_t)MOTION_GRID_WIDTH || height < (size_t)MOTION_GRID_HEIGHT) {
+        return false;
+    }
+    
+    if (decodeBuffer == nullptr || width * height * 2 > decodeBufferSize ||
+        !jpg2rgb565(fb->buf, fb->len, decodeBuffer, JPG_SCALE_8X)) {
+        LOG_W("[MOTION] Thumbnail decode failed, uploading frame");
+        return false;
+    }
+    
+    // RGB565（上位バイトが先）をブロック平均して 40x30 の7bit輝度に縮小
+    // 1.2KBあるため撮影タスクのスタックには置かない（呼び出しは cameraMutex を持つ1タスクのみ）
+    static uint32_t grid[MOTION_GRID_WORDS];
+    uint8_t* gridBytes = (uint8_t*)grid;
+    for (int gy = 0; gy < MOTION_GRID_HEIGHT; gy++) {
+        size_t y0 = gy * height / MOTION_GRID_HEIGHT;
+        size_t y1 = (gy + 1) * height / MOTION_GRID_HEIGHT;
+        for (int gx = 0; gx < MOTION_GRID_WIDTH; gx++) {
+            size_t x0 = gx * width / MOTION_GRID_WIDTH;
+            size_t x1 = (gx + 1) * width / MOTION_GRID_WIDTH;
+            uint32_t sum = 0;
+            for (size_t y = y0; y < y1; y++) {
+                const uint8_t* p = decodeBuffer + (y * width + x0) * 2;
+                for (size_t x = x0; x < x1; x++, p += 2) {
+                    uint32_t r = p[0] & 0xF8;
+                    uint32_t g = ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3);
+                    uint32_t b = (p[1] & 0x1F) << 3;
+                    sum += (77 * r + 150 * g + 29 * b) >> 8;
+                }
+            }
+            gridBytes[gy * MOTION_GRID_WIDTH + gx] = (sum / ((y1 - y0) * (x1 - x0))) >> 1;
+        }
+    }
+    
+    bool unchanged = false;
+    uint32_t meanDiff = 0;
+    if (motionRef.valid) {
+        meanDiff = sumAbsDiff7(grid, motionRef.pixels, MOTION_GRID_WORDS) /
+                   (MOTION_GRID_WIDTH * MOTION_GRID_HEIGHT);
+        unchanged = meanDiff < settings.motionThreshold;
+    }
+    
+    // 長時間変化がない場合も生存確認を兼ねて定期的に送信
+    if (unchanged && motionRef.skippedCount + 1 >= MOTION_FORCE_UPLOAD_EVERY) {
+        LOG_I("[MOTION] Forced upload after consecutive unchanged frames");
+        unchanged = false;
+    }
+    
+    if (unchanged) {
+        motionRef.skippedCount++;
+    } else {
+        memcpy(motionRef.pixels, grid, sizeof(grid));
+        motionRef.valid = true;
+        motionRef.skippedCount = 0;
+    }
+    
+    LOG_I("[MOTION] Mean diff %lu (threshold %d), %s in %lu ms",
+          (unsigned long)meanDiff, settings.motionThreshold, unchanged ? "unchanged" : "changed",
+          (unsigned long)((esp_timer_get_time() - checkStart) / 1000));
+    return unchanged;
+#else
+    return false;
+#endif
+}
+
+// タイムスタンプ付きファイル名生成
+void makePhotoFilename(char* out, size_t outSize, const char* suffix) {
+    char timestamp[32];
+    getFormattedTimestamp(timestamp, sizeof(timestamp));
+    snprintf(out, outSize, "photo_%s%s.jpg", timestamp, suffix);
+    
+    LOG_I("[PHOTO] Generated filename: %s", out);
+}
+
+// JPEGエンコーダーの出力を固定バッファに書き込む（収まらなければ0を返して中断）
+size_t writeThumbnailChunk(void* arg, size_t index, const void* data, size_t len) {
+    ThumbnailWriter* writer = (ThumbnailWriter*)arg;
+    if (data == nullptr || index + len > writer->size) {
+        return 0;
+    }
+    memcpy(writer->out + index, data, len);
+    writer->length = index + len;
+    return len;
+}
+
+// JPEGを1/THUMBNAIL_SCALEで縮小デコードし、低品質JPEGに再エンコード
+// 画素と出力のバッファはプールのものを使うが、jpg2rgb565・fmt2jpg_cb は内部の作業領域を
+// 呼び出しごとに確保・解放する（APIに外から渡す手段がない）
+// 生成したサイズを返す（0 = 失敗）
+size_t makeThumbnail(const uint8_t* jpeg, size_t jpegLength, uint16_t width, uint16_t height,
+                     uint8_t* out, size_t outSize) {
+#if THUMBNAIL_UPLOAD
+    int64_t thumbStart = esp_timer_get_time();
+    const jpg_scale_t scale = THUMBNAIL_SCALE >= 8 ? JPG_SCALE_8X
+                            : THUMBNAIL_SCALE >= 4 ? JPG_SCALE_4X
+                            : JPG_SCALE_2X;
+    uint16_t thumbWidth = width / THUMBNAIL_SCALE;
+    uint16_t thumbHeight = height / THUMBNAIL_SCALE;
+    
+    if (decodeBuffer == nullptr || out == nullptr || (size_t)thumbWidth * thumbHeight * 2 > decodeBufferSize ||
+        !jpg2rgb565(jpeg, jpegLength, decodeBuffer, scale)) {
+        LOG_W("[THUMB] Decode failed, thumbnail skipped");
+        return 0;
+    }
+    
+    ThumbnailWriter writer = {out, outSize, 0};
+    if (!fmt2jpg_cb(decodeBuffer, (size_t)thumbWidth * thumbHeight * 2, thumbWidth, thumbHeight,
+                    PIXFORMAT_RGB565, THUMBNAIL_QUALITY, writeThumbnailChunk, &writer) || writer.length == 0) {
+        LOG_W("[THUMB] Encode failed, thumbnail skipped");
+        return 0;
+    }
+    
+    LOG_I("[THUMB] %ux%u thumbnail: %u bytes in %lu ms", thumbWidth, thumbHeight,
+          (unsigned int)writer.length, (unsigned long)((esp_timer_get_time() - thumbStart) / 1000));
+    return writer.length;
+#else
+    return 0;
+#endif
+}
+
+// サムネイルのファイル名（thumbs/ 以下に本画像と同じ名前で保存）
+void makeThumbnailFilename(char* out, size_t outSize, const char* filename) {
+    snprintf(out, outSize, THUMBNAIL_PREFIX "%s", filename);
+}
@@ -0,0 +1,633 @@
+#include "capture_pipeline.h"
+#include "M5TimerCAM.h"
+#include <WiFi.h>
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+#include "camera_capture.h"
+#include "wifi_link.h"
+#include "time_sync.h"
+#include "shot_schedule.h"
+#include "offline_queue.h"
+#include "status_led.h"
+#include "local_stream.h"
+
+// 撮影パイプライン設定（撮影タスクがPSRAMスロットに書き込み、アップロードタスクが送信）
+struct FrameSlot {
+    uint8_t* buf;
+    size_t len;
+    char filename[48];
+    uint8_t* thumbBuf;       // サムネイル（THUMBNAIL_UPLOAD 有効時のみ）
+    size_t thumbLen;         // 0 = サムネイルなし
+    char thumbFilename[56];
+};
+FrameSlot frameSlots[PIPELINE_SLOT_COUNT];
+
+SlotRing freeSlotRing;   // 空きスロット（アップロードタスク → 撮影タスク）
+SlotRing readySlotRing;  // アップロード待ちスロット（撮影タスク → アップロードタスク）
+int captureSpareSlot = -1; // 撮影失敗で使わなかったスロット（撮影タスク専用）
+
+// PSRAMバッファプール: フレームスロット・キュー送信用読み出しバッファ・変化検出用バッファを
+// 起動時に1ブロックでまとめて確保し、撮影・アップロード中は確保・解放しない（断片化防止）
+uint8_t* framePoolMemory = nullptr;
+uint8_t* drainBuffer = nullptr;  // オフラインキュー送信の読み出し用（アップロード側が使用）
+bool framePoolReady = false;
+
+// 内部ヒープの最大連続ブロックの推移（断片化の監視）
+struct HeapTrend {
+    uint32_t bootLargest;
+    uint32_t minLargest;
+    uint32_t lastLargest;
+    uint32_t previousLargest;
+};
+HeapTrend heapTrend = {0, 0, 0, 0};
+std::atomic<bool> heapRestartPending(false);
+
+TaskHandle_t captureTaskHandle = NULL;
+TaskHandle_t uploadTaskHandle = NULL;
+TaskHandle_t housekeepingTaskHandle = NULL;
+bool pipelineRunning = false;
+std::atomic<int> pendingCaptures(0);
+QueueHandle_t captureRequestQueue = NULL;
+std::atomic<bool> uploadTaskBusy(false);
+std::atomic<bool> offlineDrainRequested(false);
+std::atomic<bool> pipelineStopping(false);  // シャットダウン中（撮影要求は破棄し、撮影済みはキューへ）
+const unsigned long PIPELINE_STOP_TIMEOUT = 30000; // 送信中のリクエストの完了を待つ最大時間（ミリ秒）
+
+uint8_t* thumbnailScratch = nullptr; // スロット外で撮影したフレームのサムネイル用
+
+// 撮影済みフレームをまとめてアップロードし、LEDで結果を通知
+// 通信エラー・サーバーエラーの分はオフラインキューに移して後で再送
+void uploadFrameBatch(UploadItem* items, int count) {
+    // 電池残量が危険域なら送信せず保存（充電後のキュー送信に回す）
+    if (shouldDeferUploads()) {
+        LOG_W("[POWER] Battery critical (%d%%), upload deferred to offline queue", powerSnapshot().batteryLevel);
+        for (int i = 0; i < count; i++) {
+            enqueueOfflineFrame(items[i].data, items[i].size, items[i].filename, items[i].resume);
+        }
+        return;
+    }
+    
+    // WiFi接続確認・再接続
+    if (WiFi.status() != WL_CONNECTED) {
+        LOG_W("[WiFi] Connection lost, attempting to reconnect...");
+        if (connectToWiFi()) {
+            maybeStartSntp();
+        } else {
+            int saved = 0;
+            for (int i = 0; i < count; i++) {
+                if (enqueueOfflineFrame(items[i].data, items[i].size, items[i].filename, items[i].resume)) saved++;
+            }
+            if (saved == count) {
+                LOG_E("[ERROR] WiFi reconnection failed! Photo saved locally only.");
+            } else {
+                LOG_E("[ERROR] WiFi reconnection failed! Photo discarded.");
+            }
+            // WiFi接続失敗時はLED 3回点滅
+            ledBlink(3, 100, 100);
+            return;
+        }
+    }
+    
+    // Supabaseにアップロード
+    int succeeded = uploadBatchToSupabase(items, count);
+    lastUploadStatusCode = items[count - 1].statusCode;
+    
+    if (succeeded == count) {
+        LOG_I("[UPLOAD] Photo uploaded successfully!");
+        
+#if LOG_TAIL_UPLOAD
+        // 警告・エラーがあれば同じ接続で直近のログも送る
+        if (logRing.tailPending) {
+            uploadLogTail(items[count - 1].filename);
+        }
+#endif
+        
+        // 回線が生きているうちに未送信分も送る
+        requestOfflineDrain();
+        
+        // 成功時はLED 2回点滅
+        ledBlink(2, 150, 150);
+    } else {
+        LOG_E("[UPLOAD] Photo upload failed!");
+        
+        // 通信エラー・サーバーエラーは後で再送
+        for (int i = 0; i < count; i++) {
+            int statusCode = items[i].statusCode;
+            if (statusCode == 0 || statusCode == 429 || statusCode >= 500) {
+                // 再開可能アップロードの途中なら続きから送れるよう進捗も保存
+                enqueueOfflineFrame(items[i].data, items[i].size, items[i].filename, items[i].resume);
+            }
+        }
+        
+        // 失敗時はLED 5回高速点滅
+        ledBlink(5, 100, 100);
+    }
+}
+
+// 撮影済みフレーム1枚のアップロード
+void uploadFrame(uint8_t* imageData, size_t imageSize, const char* filename) {
+    ResumableUpload resume;
+    initResumableUpload(resume, 0);
+    UploadItem item = {imageData, imageSize, filename, 0, &resume};
+    uploadFrameBatch(&item, 1);
+}
+
+// PSRAMバッファプールを1ブロックで確保（起動時に1回だけ）
+bool initFramePool() {
+    size_t decodeBytes = 0;
+    if (MOTION_DETECTION) decodeBytes = MOTION_DECODE_BUFFER_SIZE;
+    if (THUMBNAIL_UPLOAD && THUMBNAIL_DECODE_BUFFER_SIZE > decodeBytes) decodeBytes = THUMBNAIL_DECODE_BUFFER_SIZE;
+    size_t thumbnailBytes = THUMBNAIL_UPLOAD ? THUMBNAIL_MAX_SIZE * (PIPELINE_SLOT_COUNT + 1) : 0;
+    size_t logTailBytes = LOG_TAIL_UPLOAD ? LOG_TAIL_BUFFER_SIZE : 0;
+    size_t streamBytes = LOCAL_STREAM_ENABLED ? MAX_FRAME_SIZE : 0;
+    size_t poolBytes = MAX_FRAME_SIZE * (PIPELINE_SLOT_COUNT + 1) + decodeBytes + thumbnailBytes + logTailBytes + streamBytes;
+    framePoolMemory = (uint8_t*)ps_malloc(poolBytes);
+    if (framePoolMemory == nullptr) {
+        LOG_E("[POOL] PSRAM allocation failed");
+        return false;
+    }
+    
+    uint8_t* next = framePoolMemory;
+    for (int i = 0; i < PIPELINE_SLOT_COUNT; i++) {
+        frameSlots[i].buf = next;
+        frameSlots[i].len = 0;
+        next += MAX_FRAME_SIZE;
+    }
+    drainBuffer = next;
+    next += MAX_FRAME_SIZE;
+    if (decodeBytes > 0) {
+        decodeBuffer = next;
+        decodeBufferSize = decodeBytes;
+        next += decodeBytes;
+    }
+    if (thumbnailBytes > 0) {
+        for (int i = 0; i < PIPELINE_SLOT_COUNT; i++) {
+            frameSlots[i].thumbBuf = next;
+            frameSlots[i].thumbLen = 0;
+            next += THUMBNAIL_MAX_SIZE;
+        }
+        thumbnailScratch = next;
+        next += THUMBNAIL_MAX_SIZE;
+    }
+    if (logTailBytes > 0) {
+        logTailBuffer = (char*)next;
+        next += logTailBytes;
+    }
+    if (streamBytes > 0) {
+        streamFrameBuffer = next;
+    }
+    
+    framePoolReady = true;
+    sampleHeapTrend();
+    LOG_I("[POOL] Reserved %lu bytes of PSRAM, largest heap block: %lu", (unsigned long)poolBytes, (unsigned long)heapTrend.lastLargest);
+    return true;
+}
+
+// 内部ヒープの最大連続ブロックを記録し、TLS接続に足りなくなったら再起動を予約
+void sampleHeapTrend() {
+    uint32_t largest = ESP.getMaxAllocHeap();
+    if (heapTrend.bootLargest == 0) {
+        heapTrend.bootLargest = largest;
+        heapTrend.minLargest = largest;
+        heapTrend.lastLargest = largest;
+    }
+    heapTrend.previousLargest = heapTrend.lastLargest;
+    heapTrend.lastLargest = largest;
+    if (largest < heapTrend.minLargest) {
+        heapTrend.minLargest = largest;
+    }
+    
+    if (HEAP_RESTART_MIN_BLOCK > 0 && largest < HEAP_RESTART_MIN_BLOCK && !heapRestartPending) {
+        LOG_W("[HEAP] Largest block dropped to %lu bytes, restart scheduled when idle", (unsigned long)largest);
+        heapRestartPending = true;
+    }
+}
+
+// 撮影パイプライン初期化（プールのスロットを空きリングに登録してタスク起動）
+bool startCapturePipeline() {
+    if (!framePoolReady) {
+        LOG_W("[PIPELINE] Frame pool unavailable, using serial capture");
+        return false;
+    }
+    captureRequestQueue = xQueueCreate(8, sizeof(CaptureRequest));
+    if (captureRequestQueue == NULL) {
+        LOG_W("[PIPELINE] Capture request queue unavailable, using serial capture");
+        return false;
+    }
+    for (int i = 0; i < PIPELINE_SLOT_COUNT; i++) {
+        slotRingPush(freeSlotRing, i);
+    }
+    
+    // 撮影はAPP_CPU、アップロードはWiFiスタックと同じPRO_CPUで実行
+    xTaskCreatePinnedToCore(captureTask, "capture", 4096, NULL, 2, &captureTaskHandle, 1);
+    xTaskCreatePinnedToCore(uploadTask, "upload", 10240, NULL, 1, &uploadTaskHandle, 0);
+    
+    pipelineRunning = true;
+    LOG_I("[PIPELINE] Started with %d PSRAM frame slots", PIPELINE_SLOT_COUNT);
+    return true;
+}
+
+// シャットダウン前に撮影・アップロードタスクを止める（loop()から呼ぶ）
+// 未処理の撮影要求は破棄し、アップロード待ちのフレームはオフラインキューに保存して、
+// 送信中のリクエストの完了を待つ（カメラ・接続を使用中のまま停止しないため）
+bool stopCapturePipeline() {
+    if (!pipelineRunning) {
+        return true;
+    }
+    pipelineStopping = true;
+    offlineDrainRequested = false;
+    xTaskNotifyGive(uploadTaskHandle);
+    
+    unsigned long start = millis();
+    while (!isPipelineIdle() && millis() - start < PIPELINE_STOP_TIMEOUT) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    if (!isPipelineIdle()) {
+        LOG_W("[PIPELINE] Tasks still busy after %lu ms, stopping anyway", PIPELINE_STOP_TIMEOUT);
+        return false;
+    }
+    LOG_I("[PIPELINE] Stopped");
+    return true;
+}
+
+// 撮影待ち・アップロード待ちのフレームがないか
+bool isPipelineIdle() {
+    if (!pipelineRunning) return true;
+    return pendingCaptures == 0 && !uploadTaskBusy && !offlineDrainRequested &&
+           slotRingCount(readySlotRing) == 0;
+}
+
+// 1フレーム撮影してスロットに格納し、アップロード待ちに渡す
+// suffix はバースト撮影時の連番（同一秒内のファイル名重複を防ぐ）
+bool captureIntoSlot(int slotIndex, const char* suffix, bool checkChange) {
+    FrameSlot& slot = frameSlots[slotIndex];
+    
+    if (!takePhoto()) {
+        LOG_E("[PHOTO] Photo capture failed!");
+        captureSpareSlot = slotIndex;
+        return false;
+    }
+    
+    // 定時撮影で変化がなければアップロードしない
+    if (checkChange && isSceneUnchanged(TimerCAM.Camera.fb)) {
+        LOG_I("[MOTION] Scene unchanged, upload skipped");
+        TimerCAM.Camera.free();
+        captureSpareSlot = slotIndex;
+        return false;
+    }
+    
+    memcpy(slot.buf, TimerCAM.Camera.fb->buf, TimerCAM.Camera.fb->len);
+    slot.len = TimerCAM.Camera.fb->len;
+    uint16_t width = TimerCAM.Camera.fb->width;
+    uint16_t height = TimerCAM.Camera.fb->height;
+    TimerCAM.Camera.free();
+    makePhotoFilename(slot.filename, sizeof(slot.filename), suffix);
+    
+    // カメラバッファ返却後にスロットのコピーからサムネイルを生成
+    slot.thumbLen = 0;
+    if (THUMBNAIL_UPLOAD) {
+        slot.thumbLen = makeThumbnail(slot.buf, slot.len, width, height, slot.thumbBuf, THUMBNAIL_MAX_SIZE);
+        makeThumbnailFilename(slot.thumbFilename, sizeof(slot.thumbFilename), slot.filename);
+    }
+    slotRingPush(readySlotRing, slotIndex);
+    xTaskNotifyGive(uploadTaskHandle);
+    return true;
+}
+
+// バースト撮影: センサーを動かしたまま一定間隔でフレームを取得
+// 空きスロットがない場合はフラッシュのオフラインキューに保存してまとめて送信
+void captureBurst() {
+    LOG_I("[BURST] Capturing %d frames at %d fps", BURST_FRAME_COUNT, BURST_FPS);
+    
+    const TickType_t frameInterval = pdMS_TO_TICKS(1000 / BURST_FPS);
+    TickType_t lastWake = xTaskGetTickCount();
+    char suffix[8];
+    int captured = 0;
+    
+    ledSet(true);
+    for (int i = 0; i < BURST_FRAME_COUNT; i++) {
+        if (i > 0) {
+            vTaskDelayUntil(&lastWake, frameInterval);
+        }
+        snprintf(suffix, sizeof(suffix), "_b%02d", i);
+        
+        int slotIndex;
+        if (acquireFreeSlot(slotIndex, 0)) {
+            if (captureIntoSlot(slotIndex, suffix)) captured++;
+        } else if (takePhoto()) {
+            char filename[48];
+            makePhotoFilename(filename, sizeof(filename), suffix);
+            bool thumbQueued = false;
+            if (THUMBNAIL_UPLOAD) {
+                size_t thumbLen = makeThumbnail(TimerCAM.Camera.fb->buf, TimerCAM.Camera.fb->len,
+                                                TimerCAM.Camera.fb->width, TimerCAM.Camera.fb->height,
+                                                thumbnailScratch, THUMBNAIL_MAX_SIZE);
+                if (thumbLen > 0) {
+                    char thumbFilename[56];
+                    makeThumbnailFilename(thumbFilename, sizeof(thumbFilename), filename);
+                    thumbQueued = enqueueOfflineFrame(thumbnailScratch, thumbLen, thumbFilename);
+                }
+            }
+            if (THUMBNAIL_UPLOAD && !THUMBNAIL_FULL_FRAME && thumbQueued) {
+                captured++;
+            } else if (enqueueOfflineFrame(TimerCAM.Camera.fb->buf, TimerCAM.Camera.fb->len, filename)) {
+                captured++;
+            }
+            TimerCAM.Camera.free();
+        }
+    }
+    ledSet(false);
+    
+    LOG_I("[BURST] Captured %d/%d", captured, BURST_FRAME_COUNT);
+    
+    // スロットに収まらなかった分はアップロード済みスロットの後にまとめて送信
+    requestOfflineDrain();
+}
+
+// 撮影タスク: 撮影要求ごとにフレームをPSRAMスロットへコピーしてカメラバッファを即返却
+void captureTask(void* param) {
+    for (;;) {
+        CaptureRequest request;
+        if (xQueueReceive(captureRequestQueue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        
+        if (pipelineStopping) {
+            // シャットダウン中は撮影しない
+            pendingCaptures--;
+            notifyMainLoop();
+            continue;
+        }
+        
+        if (request == CAPTURE_BURST) {
+            xSemaphoreTake(cameraMutex, portMAX_DELAY);
+            captureBurst();
+            xSemaphoreGive(cameraMutex);
+            pendingCaptures--;
+            notifyMainLoop();
+            continue;
+        }
+        
+        int slotIndex;
+        if (!acquireFreeSlot(slotIndex, 5000)) {
+            LOG_W("[PIPELINE] No free frame slot, capture skipped");
+            pendingCaptures--;
+            notifyMainLoop();
+            continue;
+        }
+        
+        ledSet(true); // LED点灯で撮影開始を知らせる
+        LOG_I("[PHOTO] Taking photo...");
+        xSemaphoreTake(cameraMutex, portMAX_DELAY);
+        captureIntoSlot(slotIndex, "", request == CAPTURE_CHECKED_SHOT);
+        xSemaphoreGive(cameraMutex);
+        ledSet(false);
+        pendingCaptures--;
+        notifyMainLoop();
+    }
+}
+
+// アップロードタスク: 撮影済みスロットをまとめてアップロードして空きに戻す
+// 撮影完了・キュー送信要求の通知で起床し、撮影済みフレームを優先して処理
+void uploadTask(void* param) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uploadTaskBusy = true;
+        
+        for (;;) {
+            // 溜まっているスロットを1回のバッチにまとめる
+            int batchSlots[PIPELINE_SLOT_COUNT];
+            int batchCount = 0;
+            while (batchCount < PIPELINE_SLOT_COUNT &&
+                   slotRingPop(readySlotRing, batchSlots[batchCount])) {
+                batchCount++;
+            }
+            
+            if (batchCount > 0) {
+                // サムネイルを先にまとめて送り、本画像はその後（ダッシュボードに早く表示するため）
+                UploadItem items[PIPELINE_SLOT_COUNT * 2];
+                ResumableUpload resumes[PIPELINE_SLOT_COUNT];
+                int itemCount = 0;
+                for (int i = 0; i < batchCount; i++) {
+                    FrameSlot& slot = frameSlots[batchSlots[i]];
+                    if (THUMBNAIL_UPLOAD && slot.thumbLen > 0) {
+                        items[itemCount++] = {slot.thumbBuf, slot.thumbLen, slot.thumbFilename, 0, nullptr};
+                    }
+                }
+                for (int i = 0; i < batchCount; i++) {
+                    FrameSlot& slot = frameSlots[batchSlots[i]];
+                    if (THUMBNAIL_UPLOAD && !THUMBNAIL_FULL_FRAME && slot.thumbLen > 0) {
+                        continue; // サムネイルのみ送信（生成に失敗した場合は本画像を送る）
+                    }
+                    initResumableUpload(resumes[i], 0);
+                    items[itemCount++] = {slot.buf, slot.len, slot.filename, 0, &resumes[i]};
+                }
+                if (pipelineStopping) {
+                    // シャットダウン中は送信せず、次の起動時にキューから送る
+                    for (int i = 0; i < itemCount; i++) {
+                        enqueueOfflineFrame(items[i].data, items[i].size, items[i].filename, items[i].resume);
+                    }
+                } else {
+                    uploadFrameBatch(items, itemCount);
+                }
+                for (int i = 0; i < batchCount; i++) {
+                    frameSlots[batchSlots[i]].len = 0;
+                    frameSlots[batchSlots[i]].thumbLen = 0;
+                    slotRingPush(freeSlotRing, batchSlots[i]);
+                }
+                sampleHeapTrend();
+                
+                // 接続が残っているうちにリモート設定を確認
+                if (!pipelineStopping) maybeFetchRemoteConfig();
+            } else if (!pipelineStopping && offlineDrainRequested.exchange(false)) {
+                // オフラインキューはプールの読み出しバッファで送信
+                drainOfflineQueue(drainBuffer, MAX_FRAME_SIZE);
+            } else {
+                break;
+            }
+        }
+        
+        uploadTaskBusy = false;
+        notifyMainLoop();
+    }
+}
+
+// リングにスロット番号を追加（生産者側のみ呼ぶ）
+bool slotRingPush(SlotRing& ring, int slotIndex) {
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.head.load(std::memory_order_acquire) >= SlotRing::CAPACITY) {
+        return false;
+    }
+    ring.items[tail % SlotRing::CAPACITY] = slotIndex;
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// リングからスロット番号を取り出す（消費者側のみ呼ぶ）
+bool slotRingPop(SlotRing& ring, int& slotIndex) {
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head == ring.tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    slotIndex = ring.items[head % SlotRing::CAPACITY];
+    ring.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t slotRingCount(const SlotRing& ring) {
+    return ring.tail.load(std::memory_order_acquire) - ring.head.load(std::memory_order_acquire);
+}
+
+// 撮影タスク用: 空きスロットを取得（アップロード完了を最大 timeoutMs 待つ）
+bool acquireFreeSlot(int& slotIndex, uint32_t timeoutMs) {
+    if (captureSpareSlot >= 0) {
+        slotIndex = captureSpareSlot;
+        captureSpareSlot = -1;
+        return true;
+    }
+    uint32_t waited = 0;
+    while (!slotRingPop(freeSlotRing, slotIndex)) {
+        if (waited >= timeoutMs) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+        waited += 10;
+    }
+    return true;
+}
+
+// 状態表示・ヒープ報告を低優先度タスクで定期実行（loop()とアップロードを妨げない）
+bool startHousekeepingTask() {
+    if (xTaskCreatePinnedToCore(housekeepingTask, "housekeeping", 3072, NULL, 0,
+                                &housekeepingTaskHandle, 1) != pdPASS) {
+        LOG_E("[SYSTEM] Housekeeping task creation failed");
+        return false;
+    }
+    return true;
+}
+
+void housekeepingTask(void* param) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(HOUSEKEEPING_INTERVAL));
+        printSystemStatus();
+    }
+}
+
+// システム状態表示（稼働時間・ヒープ・WiFi・タスクのスタック余裕・処理時間）
+void printSystemStatus() {
+    unsigned long nextPhotoIn = millisUntilNextShot() / 1000;
+    LOG_I("[SYSTEM] Uptime: %lu min, Free heap: %lu bytes, Next photo in: %lu:%02lu (mm:ss)",
+          millis() / 1000 / 60, (unsigned long)ESP.getFreeHeap(), nextPhotoIn / 60, nextPhotoIn % 60);
+    
+    samplePower();
+    PowerState power = powerSnapshot();
+    LOG_I("[POWER] Battery %d%% (%d mV), %lu uAh/shot, interval %lu s",
+          power.batteryLevel, power.batteryMv, (unsigned long)power.shotUAh,
+          (unsigned long)effectiveIntervalSec());
+    
+    sampleHeapTrend();
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t fragmentation = heapTrend.lastLargest >= freeHeap ? 0 : 100 - (uint64_t)heapTrend.lastLargest * 100 / freeHeap;
+    LOG_I("[SYSTEM] Heap min free: %lu, PSRAM free: %lu bytes",
+          (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getFreePsram());
+    LOG_I("[HEAP] Largest block: %lu (prev %lu, min %lu, boot %lu), fragmentation %lu%%",
+          (unsigned long)heapTrend.lastLargest, (unsigned long)heapTrend.previousLargest,
+          (unsigned long)heapTrend.minLargest, (unsigned long)heapTrend.bootLargest,
+          (unsigned long)fragmentation);
+    if (pipelineRunning) {
+        LOG_I("[SYSTEM] Stack free (words): capture %u, upload %u, housekeeping %u",
+              (unsigned int)uxTaskGetStackHighWaterMark(captureTaskHandle),
+              (unsigned int)uxTaskGetStackHighWaterMark(uploadTaskHandle),
+              (unsigned int)uxTaskGetStackHighWaterMark(NULL));
+    }
+    
+    // WiFi状態確認
+    if (WiFi.status() == WL_CONNECTED) {
+        LOG_I("[WiFi] Connected, RSSI: %d dBm", WiFi.RSSI());
+    } else {
+        LOG_I("[WiFi] Disconnected, Status: %d", (int)WiFi.status());
+    }
+    printPhaseStats();
+}
+
+// バースト撮影要求（パイプライン動作時のみ）
+void requestBurstCapture() {
+    if (!pipelineRunning) {
+        LOG_I("[BURST] Pipeline not running, taking single photo");
+        takeAndUploadPhoto();
+        return;
+    }
+    requestCapture(CAPTURE_BURST);
+}
+
+// 撮影タスクに撮影要求を渡す（要求が溜まりすぎている場合は破棄）
+void requestCapture(CaptureRequest request) {
+    pendingCaptures++;
+    if (xQueueSend(captureRequestQueue, &request, 0) != pdTRUE) {
+        LOG_W("[PIPELINE] Too many capture requests, request dropped");
+        pendingCaptures--;
+    }
+}
+
+// 写真撮影とアップロード処理
+// パイプライン動作中は撮影要求のみ行い、アップロード完了を待たずに戻る
+// checkChange は定時撮影用（前回アップロードから変化がなければ送信しない）
+void takeAndUploadPhoto(bool checkChange) {
+    if (pipelineRunning) {
+        requestCapture(checkChange ? CAPTURE_CHECKED_SHOT : CAPTURE_SHOT);
+        return;
+    }
+    
+    ledSet(true); // LED点灯で撮影開始を知らせる
+    
+    LOG_I("[PHOTO] Taking photo...");
+    
+    // フレームバッファから直接送信するため、返却するまでカメラを占有
+    xSemaphoreTake(cameraMutex, portMAX_DELAY);
+    if (takePhoto()) {
+        if (checkChange && isSceneUnchanged(TimerCAM.Camera.fb)) {
+            LOG_I("[MOTION] Scene unchanged, upload skipped");
+            TimerCAM.Camera.free();
+            xSemaphoreGive(cameraMutex);
+            ledSet(false);
+            return;
+        }
+        
+        char filename[48];
+        makePhotoFilename(filename, sizeof(filename), "");
+        
+#if THUMBNAIL_UPLOAD
+        // サムネイルを先に送信し、続けて本画像（THUMBNAIL_FULL_FRAME 0 ではサムネイルのみ）
+        camera_fb_t* fb = TimerCAM.Camera.fb;
+        char thumbFilename[56];
+        makeThumbnailFilename(thumbFilename, sizeof(thumbFilename), filename);
+        size_t thumbLen = makeThumbnail(fb->buf, fb->len, fb->width, fb->height,
+                                        thumbnailScratch, THUMBNAIL_MAX_SIZE);
+        ResumableUpload resume;
+        initResumableUpload(resume, 0);
+        UploadItem items[2];
+        int itemCount = 0;
+        if (thumbLen > 0) {
+            items[itemCount++] = {thumbnailScratch, thumbLen, thumbFilename, 0, nullptr};
+        }
+        if (THUMBNAIL_FULL_FRAME || thumbLen == 0) {
+            items[itemCount++] = {fb->buf, fb->len, filename, 0, &resume};
+        }
+        uploadFrameBatch(items, itemCount);
+#else
+        uploadFrame(TimerCAM.Camera.fb->buf, TimerCAM.Camera.fb->len, filename);
+#endif
+        
+        // メモリクリーンアップ
+        TimerCAM.Camera.free();
+        xSemaphoreGive(cameraMutex);
+        
+        maybeFetchRemoteConfig();
+    } else {
+        xSemaphoreGive(cameraMutex);
+        LOG_E("[PHOTO] Photo capture failed!");
+        ledSet(false);
+    }
+}
@@ -11,9 +11,14 @@
 // WiFi設定
 #define WIFI_SSID "Your_WiFi_SSID"
 #define WIFI_PASSWORD "Your_WiFi_Password"
+// 固定IP（DHCPを省略して接続を高速化する場合のみ定義）
+// #define STATIC_IP "192.168.1.50"
+// #define STATIC_GATEWAY "192.168.1.1"
+// #define STATIC_SUBNET "255.255.255.0"
+// #define STATIC_DNS "192.168.1.1"
 
 // Supabase設定
-#define SUPABASE_URL "https://your-project.supabase.co"
+#define SUPABASE_URL "https://your-project.supabase.co"  // https://ホスト名[:ポート]（不正な形式はビルドエラー）
 #define SUPABASE_SERVICE_KEY "your_service_role_key_here"
 #define BUCKET_NAME "photos"
 
@@ -25,4 +30,17 @@
 #define GMT_OFFSET_SEC (9 * 3600)  // JST (UTC+9)
 #define DAYLIGHT_OFFSET_SEC 0
 
+// 任意の設定（既定値と説明は include/app_config.h の「config.hで未定義の項目のデフォルト値」を参照）
+// 既定値から変える項目だけをここで #define する。以下は変更例
+// #define SUPABASE_SPKI_PINS "<現在の鍵のSHA-256>,<次の鍵のSHA-256>"  // 証明書ピンニング（README参照）
+// #define TIMELAPSE_INTERVAL_SEC 60   // 1分ごとのタイムラプス撮影（PHOTO_INTERVAL_HOURSより優先）
+// #define DEEP_SLEEP_TIMER_MODE 1     // バッテリー運用（撮影間はDeep sleep）
+// #define BATTERY_TARGET_DAYS 30      // 満充電から30日もつよう撮影間隔を延ばす
+// #define MOTION_DETECTION 1          // 前回から変化がなければ送信を省略
+// #define THUMBNAIL_UPLOAD 1          // サムネイルを thumbs/ に先に送信
+// #define PHOTO_NOTIFY 1              // アップロード後にテーブルへ通知（テーブルの作成はREADME参照）
+// #define LOG_TAIL_UPLOAD 1           // 警告・エラー時に直近のログを logs/ へ送信
+// #define LOG_LEVEL 4                 // デバッグログも出力
+// #define RESUMABLE_UPLOAD 1          // 大きいフレームを再開可能アップロードで送信（README参照）
+
 #endif // CONFIG_H
@@ -0,0 +1,197 @@
+#include "local_stream.h"
+#include "M5TimerCAM.h"
+#include <WiFi.h>
+#include "esp_http_server.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "wifi_link.h"
+#include "capture_pipeline.h"
+#include "status_led.h"
+
+// ローカル配信モード（設置・画角調整用、読み取り専用）
+// 配信は専用サーバー（ポート81）で行い、/capture や / が配信中の接続に待たされないようにする
+#if LOCAL_STREAM_ENABLED
+httpd_handle_t localControlServer = NULL;  // ポート80: / と /capture
+httpd_handle_t localStreamServer = NULL;   // ポート81: /stream
+#endif
+std::atomic<bool> localStreamActive(false);
+std::atomic<int> localStreamClients(0);
+std::atomic<uint32_t> localStreamLastActivity(0);
+uint8_t* streamFrameBuffer = nullptr;
+
+#if LOCAL_STREAM_ENABLED
+esp_err_t localIndexHandler(httpd_req_t* req);
+esp_err_t localCaptureHandler(httpd_req_t* req);
+esp_err_t localStreamHandler(httpd_req_t* req);
+#endif
+
+// ローカル配信モード開始（配信用とトップ・単発撮影用の2つのHTTPサーバーを起動）
+bool startLocalStream() {
+#if LOCAL_STREAM_ENABLED
+    if (localStreamActive) {
+        return true;
+    }
+    if (WiFi.status() != WL_CONNECTED && !connectToWiFi()) {
+        LOG_W("[STREAM] WiFi not connected, local stream unavailable");
+        ledBlink(3, 100, 100);
+        return false;
+    }
+    
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 80;
+    config.ctrl_port = 32768;
+    if (httpd_start(&localControlServer, &config) != ESP_OK) {
+        LOG_E("[STREAM] Control server start failed");
+        localControlServer = NULL;
+        return false;
+    }
+    httpd_uri_t indexUri = {"/", HTTP_GET, localIndexHandler, NULL};
+    httpd_uri_t captureUri = {"/capture", HTTP_GET, localCaptureHandler, NULL};
+    httpd_register_uri_handler(localControlServer, &indexUri);
+    httpd_register_uri_handler(localControlServer, &captureUri);
+    
+    config.server_port = 81;
+    config.ctrl_port = 32769;
+    if (httpd_start(&localStreamServer, &config) != ESP_OK) {
+        LOG_E("[STREAM] Stream server start failed");
+        httpd_stop(localControlServer);
+        localControlServer = NULL;
+        localStreamServer = NULL;
+        return false;
+    }
+    httpd_uri_t streamUri = {"/stream", HTTP_GET, localStreamHandler, NULL};
+    httpd_register_uri_handler(localStreamServer, &streamUri);
+    
+    localStreamLastActivity = millis();
+    localStreamActive = true;
+    ledBlink(2, 300, 100);
+    
+    LOG_I("[STREAM] Local stream mode: http://%s/ (stream on port 81, single shot at /capture)", WiFi.localIP().toString().c_str());
+    return true;
+#else
+    return false;
+#endif
+}
+
+// ローカル配信モード終了（配信中のハンドラーはフラグを見て終了する）
+void stopLocalStream() {
+#if LOCAL_STREAM_ENABLED
+    if (!localStreamActive) {
+        return;
+    }
+    localStreamActive = false;
+    for (int i = 0; i < 50 && localStreamClients > 0; i++) {
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    httpd_stop(localStreamServer);
+    httpd_stop(localControlServer);
+    localStreamServer = NULL;
+    localControlServer = NULL;
+    lastActivityTime = millis();
+    ledBlink(1, 300, 0);
+    LOG_I("[STREAM] Local stream mode stopped");
+#endif
+}
+
+#if LOCAL_STREAM_ENABLED
+// トップページ（配信の表示のみ）
+esp_err_t localIndexHandler(httpd_req_t* req) {
+    static const char page[] =
+        "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width\">"
+        "<title>M5TimerCAM</title></head><body style=\"margin:0;background:#000\">"
+        "<img id=\"s\" style=\"width:100%\"><script>"
+        "document.getElementById('s').src=location.protocol+'//'+location.hostname+':81/stream';"
+        "</script></body></html>";
+    static const char busyPage[] =
+        "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width\">"
+        "<title>M5TimerCAM</title></head><body>"
+        "<p>Another viewer is watching the stream.</p><p><a href=\"/capture\">Single shot</a></p>"
+        "</body></html>";
+    localStreamLastActivity = millis();
+    httpd_resp_set_type(req, "text/html");
+    // 配信サーバーは1接続ずつ処理するため、2人目の閲覧者は配信ではなくこのページで断る
+    if (localStreamClients > 0) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "10");
+        return httpd_resp_send(req, busyPage, sizeof(busyPage) - 1);
+    }
+    return httpd_resp_send(req, page, sizeof(page) - 1);
+}
+
+// 単発撮影: カメラのフレームバッファをコピーせずそのまま送信
+esp_err_t localCaptureHandler(httpd_req_t* req) {
+    localStreamLastActivity = millis();
+    xSemaphoreTake(cameraMutex, portMAX_DELAY);
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (fb == NULL) {
+        xSemaphoreGive(cameraMutex);
+        LOG_E("[STREAM] Capture failed");
+        return httpd_resp_send_500(req);
+    }
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    esp_err_t result = httpd_resp_send(req, (const char*)fb->buf, fb->len);
+    esp_camera_fb_return(fb);
+    xSemaphoreGive(cameraMutex);
+    return result;
+}
+
+// MJPEG配信: cameraMutex を持つのはフレーム取得とPSRAMへのコピーの間だけで、送信はロック外で行う
+// 配信ハンドラー（優先度5）は撮影タスクやloop()より優先度が高く、返却直後に取り直すと待ち側が
+// 永久にロックを取れないため、フレームごとに1tick譲ってから次のフレームを取る
+// 配信サーバーのタスクは1接続を処理し続けるので、閲覧者は1人まで（2人目はトップページで503）
+esp_err_t localStreamHandler(httpd_req_t* req) {
+    static const char boundary[] = "\r\n--frame\r\n";
+    char partHeader[64];
+    
+    if (streamFrameBuffer == nullptr) {
+        LOG_W("[STREAM] No stream buffer, rejecting viewer");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    httpd_resp_set_type(req, "multipart/x-mixed-replace;boundary=frame");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    localStreamClients++;
+    LOG_I("[STREAM] Viewer connected");
+    
+    esp_err_t result = ESP_OK;
+    while (localStreamActive && result == ESP_OK) {
+        xSemaphoreTake(cameraMutex, portMAX_DELAY);
+        camera_fb_t* fb = esp_camera_fb_get();
+        if (fb == NULL) {
+            xSemaphoreGive(cameraMutex);
+            result = ESP_FAIL;
+            break;
+        }
+        size_t frameLength = fb->len;
+        if (frameLength <= MAX_FRAME_SIZE) {
+            memcpy(streamFrameBuffer, fb->buf, frameLength);
+        }
+        esp_camera_fb_return(fb);
+        xSemaphoreGive(cameraMutex);
+        vTaskDelay(1);
+        if (frameLength > MAX_FRAME_SIZE) {
+            continue;
+        }
+        
+        int headerLength = snprintf(partHeader, sizeof(partHeader),
+                                    "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+                                    (unsigned int)frameLength);
+        result = httpd_resp_send_chunk(req, boundary, sizeof(boundary) - 1);
+        if (result == ESP_OK) {
+            result = httpd_resp_send_chunk(req, partHeader, headerLength);
+        }
+        if (result == ESP_OK) {
+            result = httpd_resp_send_chunk(req, (const char*)streamFrameBuffer, frameLength);
+        }
+        localStreamLastActivity = millis();
+    }
+    
+    localStreamClients--;
+    LOG_I("[STREAM] Viewer disconnected");
+    return result;
+}
+
+#endif
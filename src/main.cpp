@@ -9,690 +9,501 @@
 
 #include "M5TimerCAM.h"
 #include <WiFi.h>
-#include <WiFiClientSecure.h>
 #include "esp_sleep.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 #include "time.h"
-#include "config.h"  // 設定ファイル
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+#include "camera_capture.h"
+#include "wifi_link.h"
+#include "time_sync.h"
+#include "shot_schedule.h"
+#include "offline_queue.h"
+#include "capture_pipeline.h"
+#include "status_led.h"
+#include "tls_client.h"
+#include "supabase_upload.h"
+#include "local_stream.h"
+#include "benchmark.h"
 
-// WiFi設定（config.hから読み込み）
-const char* ssid     = WIFI_SSID;
-const char* password = WIFI_PASSWORD;
-
-// NTPサーバー設定（config.hから読み込み）
-const char* ntpServer = NTP_SERVER;
-const long gmtOffset_sec = GMT_OFFSET_SEC;
-const int daylightOffset_sec = DAYLIGHT_OFFSET_SEC;
-
-// Supabase設定（config.hから読み込み）
-const char* SUPABASE_URL_CONST = SUPABASE_URL;  
-const char* SUPABASE_SERVICE_KEY_CONST = SUPABASE_SERVICE_KEY;
-const char* BUCKET_NAME_CONST = BUCKET_NAME;
-
-// タイマー撮影設定（config.hから読み込み）
-const unsigned long PHOTO_INTERVAL = PHOTO_INTERVAL_HOURS * 3600000; // 時間をミリ秒に変換
+// Deep sleepをまたいで保持するスケジュール状態（RTCメモリ）
+RTC_DATA_ATTR RtcScheduleState rtcState = {0, 0, 0, 0, 0, 1};
+bool timerWakeBoot = false;     // タイマーによるDeep sleep復帰で起動したか
+unsigned long lastActivityTime = 0;
 unsigned long lastPhotoTime = 0;
 
-// WiFi再接続設定
-const int MAX_WIFI_RETRY = 3;
-const unsigned long WIFI_RETRY_DELAY = 5000; // 5秒
+SemaphoreHandle_t cameraMutex = NULL;  // カメラドライバーの排他（撮影タスク・配信ハンドラー・逐次撮影）
+SemaphoreHandle_t wifiMutex = NULL;    // WiFi接続処理の排他（アップロードタスクとloop()から呼ばれる）
+portMUX_TYPE stateMux = portMUX_INITIALIZER_UNLOCKED;
 
-// Light Sleep設定
-const unsigned long LIGHT_SLEEP_DURATION = 30000000; // 30秒（マイクロ秒）
+// loop()を起こすイベント通知（ボタン割り込み・撮影/アップロード完了）
+TaskHandle_t mainLoopTaskHandle = NULL;
 
-// ピン定義
-#define CAMERA_LED_GPIO 2
-#define EXTERNAL_BUTTON_GPIO 4  // 外部ボタン（EXT_PIN_1）- プルアップ抵抗付きで制御可能
-#define POWER_BUTTON_GPIO 38  // 本体ボタン（input-only, 制御不可）
+const unsigned long BUTTON_DEBOUNCE_MS = 40;  // 接点のチャタリングを無視する時間（この間レベルが変わらなければ確定）
 
 // 関数宣言
-bool uploadPhotoToSupabase(uint8_t* imageData, size_t imageSize, String filename);
-void takeAndUploadPhoto();
 void handleShutdown();
-bool connectToWiFi();
-String getFormattedTimestamp();
-void enterLightSleep();
-void loadEnvironmentVariables();
-
-// 設定読み込み関数（config.hから設定を読み込み）
-void loadEnvironmentVariables() {
-    Serial.println("[CONFIG] Loading configuration from config.h");
-    Serial.print("[CONFIG] WiFi SSID: ");
-    Serial.println(ssid);
-    Serial.print("[CONFIG] Supabase URL: ");
-    Serial.println(SUPABASE_URL_CONST);
-    Serial.print("[CONFIG] Bucket Name: ");
-    Serial.println(BUCKET_NAME_CONST);
-    Serial.print("[CONFIG] Photo Interval: ");
-    Serial.print(PHOTO_INTERVAL_HOURS);
-    Serial.println(" hour(s)");
-}
+void buttonInterrupt();
+void printBootDiagnostics(esp_reset_reason_t reset_reason);
+void printPinDiagnostics();
+void printReadyBanner();
 
-// 写真撮影関数
-bool takePhoto() {
-    // メモリチェック
-    if (ESP.getFreeHeap() < 20000) {
-        Serial.println("[SAFETY] Insufficient memory for camera operation");
-        return false;
-    }
-    
-    bool result = TimerCAM.Camera.get();
+// リセット理由とメモリ状況の表示（起動診断）
+void printBootDiagnostics(esp_reset_reason_t reset_reason) {
+    // 環境変数読み込み
+    loadEnvironmentVariables();
     
-    if (result) {
-        // フレームサイズの妥当性チェック
-        if (TimerCAM.Camera.fb->len == 0) {
-            Serial.println("[SAFETY] Invalid frame size (0 bytes)");
-            TimerCAM.Camera.free();
-            return false;
-        }
-        
-        if (TimerCAM.Camera.fb->len > 500000) {
-            Serial.println("[SAFETY] Frame too large, may cause memory issues");
-            TimerCAM.Camera.free();
-            return false;
-        }
-        
-        // バッファの妥当性チェック
-        if (TimerCAM.Camera.fb->buf == nullptr) {
-            Serial.println("[SAFETY] Invalid buffer pointer");
-            TimerCAM.Camera.free();
-            return false;
-        }
-        
-        Serial.print("[PHOTO] Photo captured - Size: ");
-        Serial.print(TimerCAM.Camera.fb->len);
-        Serial.println(" bytes");
-    } else {
-        Serial.println("[ERROR] Photo capture failed!");
+    const char* reason;
+    switch(reset_reason) {
+        case ESP_RST_POWERON: reason = "Power-on reset"; break;
+        case ESP_RST_EXT: reason = "External reset"; break;
+        case ESP_RST_SW: reason = "Software reset"; break;
+        case ESP_RST_PANIC: reason = "PANIC RESET!"; break;
+        case ESP_RST_INT_WDT: reason = "WATCHDOG RESET!"; break;
+        case ESP_RST_TASK_WDT: reason = "TASK WATCHDOG RESET!"; break;
+        case ESP_RST_WDT: reason = "OTHER WATCHDOG RESET!"; break;
+        case ESP_RST_DEEPSLEEP: reason = "Deep sleep reset"; break;
+        case ESP_RST_BROWNOUT: reason = "BROWNOUT RESET!"; break;
+        case ESP_RST_SDIO: reason = "SDIO reset"; break;
+        default: reason = "Unknown reset"; break;
     }
+    LOG_I("[SYSTEM] Reset reason: %s", reason);
     
-    return result;
+    // メモリ情報を詳細表示
+    LOG_I("[SYSTEM] Free heap: %lu", (unsigned long)ESP.getFreeHeap());
+    LOG_I("[SYSTEM] Largest free block: %lu", (unsigned long)ESP.getMaxAllocHeap());
+    LOG_I("[SYSTEM] Total heap: %lu", (unsigned long)ESP.getHeapSize());
+    
+    // TLSのハードウェアアクセラレーションとレコードバッファ（フレームワークのsdkconfigで決まる）
+    LOG_I("[TLS] Chain verification: %s", TLS_VERIFY_CHAIN ? "root CAs" : "off (pins only)");
+    char accel[16] = "";
+#ifdef CONFIG_MBEDTLS_HARDWARE_AES
+    strcat(accel, " AES");
+#endif
+#ifdef CONFIG_MBEDTLS_HARDWARE_SHA
+    strcat(accel, " SHA");
+#endif
+#ifdef CONFIG_MBEDTLS_HARDWARE_MPI
+    strcat(accel, " MPI");
+#endif
+    LOG_I("[TLS] Hardware acceleration:%s", accel);
+#if defined(CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN) && defined(CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN)
+    LOG_I("[TLS] Record buffers: in %d, out %d bytes",
+          CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN, CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN);
+#endif
 }
 
-// WiFi接続関数（エラーハンドリング付き）
-bool connectToWiFi() {
-    WiFi.mode(WIFI_STA);
-    WiFi.setSleep(false);
-    
-    for (int retry = 0; retry < MAX_WIFI_RETRY; retry++) {
-        Serial.print("[WiFi] Connecting attempt ");
-        Serial.print(retry + 1);
-        Serial.print("/");
-        Serial.println(MAX_WIFI_RETRY);
-        
-        WiFi.begin(ssid, password);
-        
-        unsigned long startTime = millis();
-        while (WiFi.status() != WL_CONNECTED && millis() - startTime < 15000) {
-            delay(500);
-            Serial.print(".");
-        }
-        
-        if (WiFi.status() == WL_CONNECTED) {
-            Serial.println();
-            Serial.println("[WiFi] Connected successfully!");
-            Serial.print("[WiFi] IP address: ");
-            Serial.println(WiFi.localIP());
-            Serial.print("[WiFi] Signal strength: ");
-            Serial.print(WiFi.RSSI());
-            Serial.println(" dBm");
-            return true;
-        } else {
-            Serial.println();
-            Serial.print("[WiFi] Connection failed. Status: ");
-            Serial.println(WiFi.status());
-            
-            if (retry < MAX_WIFI_RETRY - 1) {
-                Serial.print("[WiFi] Retrying in ");
-                Serial.print(WIFI_RETRY_DELAY / 1000);
-                Serial.println(" seconds...");
-                delay(WIFI_RETRY_DELAY);
-            }
-        }
-    }
+// 起動時のピン状態表示
+void printPinDiagnostics() {
+    LOG_I("EXTERNAL_BUTTON_GPIO (4) initial state: %s", digitalRead(EXTERNAL_BUTTON_GPIO) ? "HIGH (Released)" : "LOW (Pressed)");
+    LOG_I("POWER_BUTTON_GPIO (38) initial state: %s", digitalRead(POWER_BUTTON_GPIO) ? "HIGH" : "LOW");
     
-    Serial.println("[WiFi] Failed to connect after all retries!");
-    return false;
-}
-
-// タイムスタンプ生成関数
-String getFormattedTimestamp() {
-    struct tm timeinfo;
-    if (!getLocalTime(&timeinfo)) {
-        Serial.println("[TIME] Failed to obtain time");
-        // NTP取得失敗時はmillis()を使用
-        return String(millis());
+    // もしボタンが押されている場合は警告
+    if (digitalRead(EXTERNAL_BUTTON_GPIO) == LOW) {
+        LOG_I("INFO: External button (GPIO 4) is pressed at startup!");
     }
     
-    char timeStringBuff[50];
-    strftime(timeStringBuff, sizeof(timeStringBuff), "%Y%m%d_%H%M%S", &timeinfo);
-    return String(timeStringBuff);
+    LOG_I("NOTE: M5TimerCAM has no physical power button.");
+    LOG_I("Use external button on GPIO 4 for power control.");
 }
 
-// Light Sleep関数
-void enterLightSleep() {
-    Serial.println("[SLEEP] Entering light sleep for 30 seconds...");
-    Serial.flush();
-    
-    // WiFiを一時的に無効化
-    WiFi.setSleep(true);
-    
-    // Light Sleep実行
-    esp_sleep_enable_timer_wakeup(LIGHT_SLEEP_DURATION);
-    esp_light_sleep_start();
-    
-    Serial.println("[SLEEP] Woke up from light sleep");
-    
-    // WiFiを再有効化
-    WiFi.setSleep(false);
+// 起動完了メッセージ
+void printReadyBanner() {
+    LOG_I("Timer photo system ready!");
+    LOG_I("Photos will be taken every %lu s and uploaded to Supabase.", (unsigned long)effectiveIntervalSec());
+    LOG_I("System features:");
+    LOG_I("  - Auto WiFi reconnection");
+    LOG_I("  - Light sleep power saving");
+    LOG_I("  - Timestamp-based filenames");
+    LOG_I("  - Environment variable support");
+    LOG_I("Supabase configuration:");
+    LOG_I("  URL: %s", CONFIG.supabaseUrl);
+    LOG_I("  Bucket: %s", settings.bucket);
+    LOG_I("Configuration:");
+    LOG_I("  Edit src/config.h to change settings");
+    LOG_I("Environment variables:");
+    LOG_I("  SUPABASE_SERVICE_KEY - Set your Supabase Service Role Key");
 }
 
 void setup() {
     // TimerCAM初期化
     TimerCAM.begin();
     
-    // 環境変数読み込み
-    loadEnvironmentVariables();
-    
     // リセット理由を確認
     esp_reset_reason_t reset_reason = esp_reset_reason();
-    Serial.print("[SYSTEM] Reset reason: ");
-    switch(reset_reason) {
-        case ESP_RST_POWERON: Serial.println("Power-on reset"); break;
-        case ESP_RST_EXT: Serial.println("External reset"); break;
-        case ESP_RST_SW: Serial.println("Software reset"); break;
-        case ESP_RST_PANIC: Serial.println("PANIC RESET!"); break;
-        case ESP_RST_INT_WDT: Serial.println("WATCHDOG RESET!"); break;
-        case ESP_RST_TASK_WDT: Serial.println("TASK WATCHDOG RESET!"); break;
-        case ESP_RST_WDT: Serial.println("OTHER WATCHDOG RESET!"); break;
-        case ESP_RST_DEEPSLEEP: Serial.println("Deep sleep reset"); break;
-        case ESP_RST_BROWNOUT: Serial.println("BROWNOUT RESET!"); break;
-        case ESP_RST_SDIO: Serial.println("SDIO reset"); break;
-        default: Serial.println("Unknown reset"); break;
-    }
     
-    // メモリ情報を詳細表示
-    Serial.print("[SYSTEM] Free heap: ");
-    Serial.println(ESP.getFreeHeap());
-    Serial.print("[SYSTEM] Largest free block: ");
-    Serial.println(ESP.getMaxAllocHeap());
-    Serial.print("[SYSTEM] Total heap: ");
-    Serial.println(ESP.getHeapSize());
+    // ログリング（前回のDeep sleep・リセット直前の未出力分があれば最初に出力される）
+    initLogRing(reset_reason);
+    startLogTask();
+    cameraMutex = xSemaphoreCreateMutex();
+    wifiMutex = xSemaphoreCreateMutex();
+    rtcState.bootCount++;
+    timerWakeBoot = (reset_reason == ESP_RST_DEEPSLEEP &&
+                     esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER);
+    
+    // 実行時設定をNVSから読み込み（未保存の項目はconfig.hの値）
+    loadRuntimeSettings();
+    
+    // 時刻はRTCで保持されているためタイムゾーンのみ設定
+    applyTimeZone();
+    
+    // タイマー復帰時は診断表示・LED演出・NTP待ちを省略して撮影を最優先（DEBUG_BOOTで表示）
+    bool verboseBoot = DEBUG_BOOT || !timerWakeBoot;
+    if (verboseBoot) {
+        printBootDiagnostics(reset_reason);
+    }
     
     // LED設定
     pinMode(CAMERA_LED_GPIO, OUTPUT);
-    digitalWrite(CAMERA_LED_GPIO, HIGH); // 起動時LED点灯
+    startLedTask();
+    ledSet(!timerWakeBoot); // 起動時LED点灯
     
     // 外部ボタン設定（GPIO 4 - 制御可能）
+    // 押下・解放の割り込みでloop()を起こす（ポーリング不要）
     pinMode(EXTERNAL_BUTTON_GPIO, INPUT_PULLUP);
+    mainLoopTaskHandle = xTaskGetCurrentTaskHandle();
+    attachInterrupt(digitalPinToInterrupt(EXTERNAL_BUTTON_GPIO), buttonInterrupt, CHANGE);
     
     // 本体ボタン設定（GPIO 38 - input-only, 制御不可）
     pinMode(POWER_BUTTON_GPIO, INPUT);  // プルアップなし
     
-    // 起動時のピン状態を確認
-    Serial.print("EXTERNAL_BUTTON_GPIO (4) initial state: ");
-    Serial.println(digitalRead(EXTERNAL_BUTTON_GPIO) ? "HIGH (Released)" : "LOW (Pressed)");
-    Serial.print("POWER_BUTTON_GPIO (38) initial state: ");
-    Serial.println(digitalRead(POWER_BUTTON_GPIO) ? "HIGH" : "LOW");
-    
-    // もしボタンが押されている場合は警告
-    if (digitalRead(EXTERNAL_BUTTON_GPIO) == LOW) {
-        Serial.println("INFO: External button (GPIO 4) is pressed at startup!");
+    if (verboseBoot) {
+        // 起動時のピン状態を確認
+        printPinDiagnostics();
+        LOG_I("M5TimerCAM Timer Photo Starting...");
     }
-    
-    Serial.println("NOTE: M5TimerCAM has no physical power button.");
-    Serial.println("Use external button on GPIO 4 for power control.");
-    
-    Serial.println("M5TimerCAM Timer Photo Starting...");
 
     // カメラ初期化
+    int64_t cameraInitStart = esp_timer_get_time();
     if (!TimerCAM.Camera.begin()) {
-        Serial.println("Camera Init Fail");
+        LOG_E("Camera Init Fail");
         // エラー時はLED点滅
-        for(int i = 0; i < 10; i++) {
-            digitalWrite(CAMERA_LED_GPIO, !digitalRead(CAMERA_LED_GPIO));
-            delay(200);
-        }
+        ledBlink(5, 200, 200);
         return;
     }
-    Serial.println("Camera Init Success");
+    recordPhase(PHASE_CAMERA_INIT, cameraInitStart);
+    LOG_I("Camera Init Success");
 
     // カメラ設定（タイマー撮影用に最適化）
     TimerCAM.Camera.sensor->set_pixformat(TimerCAM.Camera.sensor, PIXFORMAT_JPEG);
-    TimerCAM.Camera.sensor->set_framesize(TimerCAM.Camera.sensor, FRAMESIZE_VGA); // VGAサイズに変更（軽量化）
     TimerCAM.Camera.sensor->set_vflip(TimerCAM.Camera.sensor, 1);
     TimerCAM.Camera.sensor->set_hmirror(TimerCAM.Camera.sensor, 0);
-    TimerCAM.Camera.sensor->set_quality(TimerCAM.Camera.sensor, 12); // 品質設定（10-63, 低いほど高品質）
+    // 解像度と画質（初期値 VGA・品質12、ADAPTIVE_ENCODER 有効時は撮影ごとに調整）
+    applyEncoderLevel(ADAPTIVE_ENCODER ? encoderSnapshot().level : ENCODER_DEFAULT_LEVEL);
+    
+    // タイマー復帰時は前回安定した露出から始めて安定待ちを短くする
+    restoreSensorExposure();
+
+    // アップロード要求の固定部分と証明書ピンを準備
+    initUploadRequestTemplate();
+    initCertificatePins();
+
+    // オフラインキュー復元（前回未送信のフレーム）
+    initOfflineQueue(timerWakeBoot && rtcState.queuePending == 0);
 
+    // PSRAMバッファプール確保（以降のフレーム・縮小画像・サムネイルのバッファは確保しない）
+    initFramePool();
+
+#if !BENCHMARK_MODE
+    // 撮影・アップロードの並行パイプライン起動（失敗時は逐次処理）
+    // ベンチマークはloop()のタスクだけで uploadClient を使うため起動しない
+    startCapturePipeline();
+#endif
+    
+    // 状態表示は低優先度のハウスキーピングタスクで行う
+    startHousekeepingTask();
+    
+    // 初回撮影時刻を設定
+    lastPhotoTime = millis();
+    lastActivityTime = millis();
+#if DEEP_SLEEP_TIMER_MODE
+    // タイマー復帰時は保存済みの予定時刻をそのまま使う
+    if (rtcState.nextShotEpoch == 0) {
+        scheduleNextShot();
+    }
+#endif
+    
+    // Deep sleep用のボタン割り込み設定
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)EXTERNAL_BUTTON_GPIO, 0); // GPIO 4がLOWで起動
+    
+    if (timerWakeBoot) {
+        // WiFi接続は撮影後にアップロード処理の中で行う（撮影までの時間を最短化）
+        LOG_I("[WAKEUP] Timer wake #%lu - taking scheduled photo", (unsigned long)rtcState.bootCount);
+        return;
+    }
+
+    // 停電復旧時は全台が同時に起動するため、端末ごとにずらしてからAPに接続
+    if (FLEET_BOOT_JITTER_MS > 0 && (reset_reason == ESP_RST_POWERON || reset_reason == ESP_RST_BROWNOUT)) {
+        unsigned long jitterMs = (deviceHash() >> 8) % FLEET_BOOT_JITTER_MS;
+        LOG_I("[WiFi] Power-on jitter: %lu ms", jitterMs);
+        vTaskDelay(pdMS_TO_TICKS(jitterMs));
+    }
+    
     // WiFi接続
     if (!connectToWiFi()) {
-        Serial.println("[ERROR] WiFi connection failed! System will continue without network.");
+        LOG_E("[ERROR] WiFi connection failed! System will continue without network.");
         // WiFi接続失敗でもカメラ機能は使用可能
     } else {
-        // NTP時刻同期
-        Serial.println("[TIME] Configuring time...");
-        configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
+        // 時刻はRTCで保持し、アップロード応答のDateヘッダーで補正（SNTPは必要な時だけ裏で実行）
+        maybeStartSntp();
         
-        // 時刻同期完了まで待機
-        struct tm timeinfo;
-        int timeoutCount = 0;
-        while (!getLocalTime(&timeinfo) && timeoutCount < 10) {
-            Serial.println("[TIME] Waiting for time sync...");
-            delay(1000);
-            timeoutCount++;
+        // 電源投入直後で時刻がない場合のみ、最初の撮影に備えて短時間だけ待つ
+        unsigned long waitStart = millis();
+        while (!isTimeValid() && millis() - waitStart < TIME_COLD_BOOT_WAIT_MS) {
+            vTaskDelay(pdMS_TO_TICKS(100));
         }
         
-        if (timeoutCount < 10) {
-            Serial.println("[TIME] Time synchronized successfully");
-            Serial.println(getFormattedTimestamp());
-        } else {
-            Serial.println("[TIME] Time sync failed, using millis() timestamps");
-        }
+        char timestamp[32];
+        getFormattedTimestamp(timestamp, sizeof(timestamp));
+        LOG_I("[TIME] Current time: %s", timestamp);
+        alignShotSchedule();
+        
+#if !BENCHMARK_MODE
+        // 前回までの未送信フレームを送信（ベンチマークの計測に混ざらないよう省略）
+        requestOfflineDrain();
+#endif
     }
     
     // WiFi接続成功でLED 3回点滅
-    digitalWrite(CAMERA_LED_GPIO, LOW);
-    for(int i = 0; i < 3; i++) {
-        digitalWrite(CAMERA_LED_GPIO, HIGH);
-        delay(300);
-        digitalWrite(CAMERA_LED_GPIO, LOW);
-        delay(300);
-    }
+    ledBlink(3, 300, 300);
 
-    Serial.println("Timer photo system ready!");
-    Serial.println("Photos will be taken every 1 hour and uploaded to Supabase.");
-    Serial.println("System features:");
-    Serial.println("  - Auto WiFi reconnection");
-    Serial.println("  - Light sleep power saving");
-    Serial.println("  - Timestamp-based filenames");
-    Serial.println("  - Environment variable support");
-    Serial.println("Supabase configuration:");
-    Serial.print("  URL: ");
-    Serial.println(SUPABASE_URL_CONST);
-    Serial.print("  Bucket: ");
-    Serial.println(BUCKET_NAME_CONST);
-    Serial.println("Configuration:");
-    Serial.println("  Edit src/config.h to change settings");
-    Serial.println("Environment variables:");
-    Serial.println("  SUPABASE_SERVICE_KEY - Set your Supabase Service Role Key");
+    printReadyBanner();
     
-    // 初回撮影時刻を設定
-    lastPhotoTime = millis();
+#if BENCHMARK_MODE
+    runBenchmark();
+#endif
     
     // Deep sleepからの復帰処理
     if (reset_reason == ESP_RST_DEEPSLEEP) {
-        Serial.println("[WAKEUP] System woke up from deep sleep");
+        LOG_I("[WAKEUP] System woke up from deep sleep");
         // ボタンで起動した場合の処理
         if (digitalRead(EXTERNAL_BUTTON_GPIO) == LOW) {
-            Serial.println("[WAKEUP] External button pressed - system ready");
+            LOG_I("[WAKEUP] External button pressed - system ready");
         }
     }
-    
-    // Deep sleep用のボタン割り込み設定
-    esp_sleep_enable_ext0_wakeup((gpio_num_t)EXTERNAL_BUTTON_GPIO, 0); // GPIO 4がLOWで起動
 }
 
 void loop() {
+#if BENCHMARK_MODE
+    // ベンチマーク結果表示後は待機のみ
+    delay(1000);
+    return;
+#endif
+    
     // 外部ボタン監視（GPIO 4）
     static unsigned long buttonPressTime = 0;
     static bool buttonPressed = false;
+    static unsigned long shortPressReleaseTime = 0;
+    static bool shortPressPending = false; // 2回押し判定待ちの短押し
+    static bool doublePress = false;
+    static bool buttonRawPressed = false;       // チャタリング込みの直近のレベル
+    static unsigned long buttonRawChangeTime = 0;
+    
+    // 割り込みはエッジごとに起きるため、レベルが BUTTON_DEBOUNCE_MS 続いてから押下・解放を確定
+    bool rawPressed = digitalRead(EXTERNAL_BUTTON_GPIO) == LOW;
+    if (rawPressed != buttonRawPressed) {
+        buttonRawPressed = rawPressed;
+        buttonRawChangeTime = millis();
+    }
+    bool buttonSettled = millis() - buttonRawChangeTime >= BUTTON_DEBOUNCE_MS;
+    bool buttonDown = buttonSettled ? rawPressed : buttonPressed;
     
     // 外部ボタン（GPIO 4）の処理
-    if (digitalRead(EXTERNAL_BUTTON_GPIO) == LOW) {
+    if (buttonDown) {
         if (!buttonPressed) {
             buttonPressed = true;
-            buttonPressTime = millis();
-            Serial.println("[BUTTON] External button pressed...");
+            buttonPressTime = buttonRawChangeTime;
+            lastActivityTime = millis();
+            LOG_I("[BUTTON] External button pressed...");
+            
+            // 短押しの直後にもう一度押した場合は2回押し
+            doublePress = shortPressPending && millis() - shortPressReleaseTime < DOUBLE_PRESS_WINDOW;
+            shortPressPending = false;
             
             // LED点滅で押下を知らせる
-            digitalWrite(CAMERA_LED_GPIO, HIGH);
-            delay(100);
-            digitalWrite(CAMERA_LED_GPIO, LOW);
+            ledBlink(1, 100, 0);
         } else if (millis() - buttonPressTime > 3000) {
-            Serial.println("[BUTTON] External button long pressed (3+ seconds) - entering deep sleep!");
+            LOG_I("[BUTTON] External button long pressed (3+ seconds) - entering deep sleep!");
             
             // LED 3回点滅でdeep sleep予告
-            for(int i = 0; i < 3; i++) {
-                digitalWrite(CAMERA_LED_GPIO, HIGH);
-                delay(200);
-                digitalWrite(CAMERA_LED_GPIO, LOW);
-                delay(200);
-            }
+            ledBlink(3, 200, 200);
             
             handleShutdown();
             return; // 関数を終了してシャットダウン処理を確実に実行
         }
     } else {
         if (buttonPressed) {
-            unsigned long pressDuration = millis() - buttonPressTime;
-            Serial.print("[BUTTON] External button released after ");
-            Serial.print(pressDuration);
-            Serial.println(" ms");
+            unsigned long pressDuration = buttonRawChangeTime - buttonPressTime;
+            LOG_I("[BUTTON] External button released after %lu ms", pressDuration);
             
-            if (pressDuration < 3000) {
-                Serial.println("[BUTTON] Short press detected - taking photo now!");
+            if (pressDuration < 1000 && doublePress) {
+                // 2回押しでローカル配信モードの開始・終了
+                LOG_I("[BUTTON] Double press detected - toggling local stream mode");
+                if (localStreamActive) {
+                    stopLocalStream();
+                } else {
+                    startLocalStream();
+                }
+            } else if (pressDuration < 1000 && LOCAL_STREAM_ENABLED) {
+                // 2回押しでないことが確定してから撮影
+                shortPressPending = true;
+                shortPressReleaseTime = millis();
+            } else if (pressDuration < 1000) {
+                LOG_I("[BUTTON] Short press detected - taking photo now!");
                 // 短押しで即座に撮影
                 takeAndUploadPhoto();
+            } else if (pressDuration < 3000) {
+                LOG_I("[BUTTON] Medium press detected - starting burst!");
+                // 1〜3秒押しでバースト撮影
+                requestBurstCapture();
             }
         }
         buttonPressed = false;
+        doublePress = false;
     }
     
+    if (shortPressPending && millis() - shortPressReleaseTime >= DOUBLE_PRESS_WINDOW) {
+        shortPressPending = false;
+        LOG_I("[BUTTON] Short press detected - taking photo now!");
+        // 短押しで撮影
+        takeAndUploadPhoto();
+    }
+    
+    // 閲覧者がいない状態が続いたら配信モードを終了
+    if (localStreamActive && localStreamClients == 0 &&
+        millis() - localStreamLastActivity > LOCAL_STREAM_IDLE_TIMEOUT) {
+        LOG_I("[STREAM] No viewers, leaving local stream mode");
+        stopLocalStream();
+    }
+    
+#if DEEP_SLEEP_TIMER_MODE
+    // タイマー撮影処理（RTCメモリの絶対時刻スケジュール）
+    if (isShotDue()) {
+        takeAndUploadPhoto(true);
+        rtcState.photoCount++;
+        time_t shotEpoch = time(nullptr);
+        portENTER_CRITICAL(&stateMux);
+        rtcState.lastPhotoEpoch = shotEpoch;
+        portEXIT_CRITICAL(&stateMux);
+        scheduleNextShot(true);
+        lastActivityTime = millis();
+    } else if (isPipelineIdle() && !buttonPressed && !shortPressPending && !localStreamActive &&
+               millisUntilNextShot() > 60000) {
+        // 次の撮影まで1分以上ある場合のみDeep sleep（タイムラプス中はセンサーを起動したまま）
+        // タイマー復帰時は処理完了後すぐ、それ以外は操作猶予後にDeep sleep
+        if (timerWakeBoot || millis() - lastActivityTime > settings.awakeGraceMs) {
+            enterTimerDeepSleep();
+        }
+    }
+#else
     // タイマー撮影処理（1時間ごと）
     unsigned long timeSinceLastPhoto = millis() - lastPhotoTime;
-    if (timeSinceLastPhoto >= PHOTO_INTERVAL) {
-        takeAndUploadPhoto();
+    if (timeSinceLastPhoto >= photoIntervalMs()) {
+        takeAndUploadPhoto(true);
         lastPhotoTime = millis();
+        alignShotSchedule(true);
     } else {
         // 次の撮影まで十分時間がある場合はLight sleep
-        unsigned long timeToNextPhoto = PHOTO_INTERVAL - timeSinceLastPhoto;
-        if (timeToNextPhoto > 60000) { // 1分以上ある場合
+        unsigned long timeToNextPhoto = photoIntervalMs() - timeSinceLastPhoto;
+        // アップロード中のフレームがある間はスリープしない
+        // 配信モード中は閲覧者のためにスリープしない
+        if (timeToNextPhoto > 60000 && isPipelineIdle() && !shortPressPending && !localStreamActive) { // 1分以上ある場合
             enterLightSleep();
         }
     }
+#endif
     
-    // システム状態表示（5分ごと）
-    static unsigned long lastSystemDebugTime = 0;
-    if (millis() - lastSystemDebugTime > 300000) { // 5分 = 300,000ms
-        unsigned long nextPhotoIn = (PHOTO_INTERVAL - (millis() - lastPhotoTime)) / 1000;
-        Serial.print("[SYSTEM] Uptime: ");
-        Serial.print(millis() / 1000 / 60);
-        Serial.print(" min, Free heap: ");
-        Serial.print(ESP.getFreeHeap());
-        Serial.print(" bytes, Next photo in: ");
-        Serial.print(nextPhotoIn / 60);
-        Serial.print(":");
-        if (nextPhotoIn % 60 < 10) Serial.print("0");
-        Serial.print(nextPhotoIn % 60);
-        Serial.println(" (mm:ss)");
-        
-        // WiFi状態確認
-        if (WiFi.status() == WL_CONNECTED) {
-            Serial.print("[WiFi] Connected, RSSI: ");
-            Serial.print(WiFi.RSSI());
-            Serial.println(" dBm");
-        } else {
-            Serial.print("[WiFi] Disconnected, Status: ");
-            Serial.println(WiFi.status());
-        }
-        
-        lastSystemDebugTime = millis();
+    // SNTPで時刻が合ったら停止（以降はアップロード応答のDateヘッダーで補正）
+    if (sntpSyncDone.exchange(false)) {
+        stopSntp();
     }
     
-    delay(100); // CPU負荷軽減
-}
-
-// 写真撮影とアップロード処理
-void takeAndUploadPhoto() {
-    digitalWrite(CAMERA_LED_GPIO, HIGH); // LED点灯で撮影開始を知らせる
-    
-    Serial.println("[PHOTO] Taking photo...");
-    
-    if (takePhoto()) {
-        // WiFi接続確認・再接続
-        if (WiFi.status() != WL_CONNECTED) {
-            Serial.println("[WiFi] Connection lost, attempting to reconnect...");
-            if (!connectToWiFi()) {
-                Serial.println("[ERROR] WiFi reconnection failed! Photo saved locally only.");
-                // WiFi接続失敗時はLED 3回点滅
-                digitalWrite(CAMERA_LED_GPIO, LOW);
-                for(int i = 0; i < 3; i++) {
-                    digitalWrite(CAMERA_LED_GPIO, HIGH);
-                    delay(100);
-                    digitalWrite(CAMERA_LED_GPIO, LOW);
-                    delay(100);
-                }
-                TimerCAM.Camera.free();
-                return;
-            }
-        }
-        
-        // タイムスタンプ付きファイル名生成
-        String timestamp = getFormattedTimestamp();
-        String filename = "photo_" + timestamp + ".jpg";
-        
-        Serial.print("[PHOTO] Generated filename: ");
-        Serial.println(filename);
-        
-        // Supabaseにアップロード
-        if (uploadPhotoToSupabase(TimerCAM.Camera.fb->buf, TimerCAM.Camera.fb->len, filename)) {
-            Serial.println("[UPLOAD] Photo uploaded successfully!");
-            
-            // 成功時はLED 2回点滅
-            digitalWrite(CAMERA_LED_GPIO, LOW);
-            for(int i = 0; i < 2; i++) {
-                digitalWrite(CAMERA_LED_GPIO, HIGH);
-                delay(150);
-                digitalWrite(CAMERA_LED_GPIO, LOW);
-                delay(150);
-            }
-        } else {
-            Serial.println("[UPLOAD] Photo upload failed!");
-            
-            // 失敗時はLED 5回高速点滅
-            for(int i = 0; i < 5; i++) {
-                digitalWrite(CAMERA_LED_GPIO, HIGH);
-                delay(100);
-                digitalWrite(CAMERA_LED_GPIO, LOW);
-                delay(100);
-            }
-        }
-        
-        // メモリクリーンアップ
-        TimerCAM.Camera.free();
-    } else {
-        Serial.println("[PHOTO] Photo capture failed!");
-        digitalWrite(CAMERA_LED_GPIO, LOW);
-    }
-}
-
-// SupabaseストレージにアップロードするHTTPS関数（エラーハンドリング強化）
-bool uploadPhotoToSupabase(uint8_t* imageData, size_t imageSize, String filename) {
-    if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("[UPLOAD] WiFi not connected!");
-        return false;
+    // ヒープ断片化でTLS接続ができなくなる前に、アイドル時に再起動（未送信分はフラッシュに保存済み）
+    if (heapRestartPending && isPipelineIdle() && !buttonPressed) {
+        LOG_W("[HEAP] Restarting to recover from heap fragmentation");
+        closeUploadConnection();
+        waitForLedIdle();
+        logFlush();
+        ESP.restart();
     }
     
-    if (imageData == nullptr || imageSize == 0) {
-        Serial.println("[UPLOAD] Invalid image data!");
-        return false;
+    // 次のイベント（ボタン・撮影/アップロード完了・撮影予定・長押し判定）まで待機
+    unsigned long waitMs = LOOP_IDLE_WAIT_MAX;
+    unsigned long untilShot = millisUntilNextShot();
+    if (untilShot < waitMs) waitMs = untilShot;
+    if (!buttonSettled) {
+        unsigned long untilSettled = BUTTON_DEBOUNCE_MS - (millis() - buttonRawChangeTime);
+        if (untilSettled < waitMs) waitMs = untilSettled;
     }
-    
-    Serial.print("[UPLOAD] Uploading ");
-    Serial.print(imageSize);
-    Serial.print(" bytes to Supabase as ");
-    Serial.println(filename);
-    
-    // WiFiClientSecureを使用（HTTPS）
-    WiFiClientSecure client;
-    
-    // SSL証明書の検証を無効化（簡単な実装のため）
-    client.setInsecure();
-    
-    // 接続タイムアウト設定
-    client.setTimeout(30000); // 30秒
-    
-    // Supabaseのホスト名を抽出
-    String host = String(SUPABASE_URL_CONST);
-    host.replace("https://", "");
-    host.replace("http://", "");
-    
-    Serial.print("[UPLOAD] Connecting to host: ");
-    Serial.println(host);
-    
-    // 接続リトライ機能
-    int connectionRetries = 3;
-    bool connected = false;
-    
-    for (int i = 0; i < connectionRetries && !connected; i++) {
-        Serial.print("[UPLOAD] Connection attempt ");
-        Serial.print(i + 1);
-        Serial.print("/");
-        Serial.println(connectionRetries);
-        
-        if (client.connect(host.c_str(), 443)) {
-            connected = true;
-            Serial.println("[UPLOAD] Connected to Supabase");
-        } else {
-            Serial.print("[UPLOAD] Connection failed, attempt ");
-            Serial.println(i + 1);
-            if (i < connectionRetries - 1) {
-                delay(2000); // 2秒待機してリトライ
-            }
-        }
+    if (buttonPressed) {
+        unsigned long held = millis() - buttonPressTime;
+        unsigned long untilLongPress = held < 3000 ? 3000 - held + 1 : 1;
+        if (untilLongPress < waitMs) waitMs = untilLongPress;
     }
-    
-    if (!connected) {
-        Serial.println("[UPLOAD] Failed to connect after all retries!");
-        return false;
-    }
-    
-    // パス生成
-    String path = "/storage/v1/object/" + String(BUCKET_NAME_CONST) + "/" + filename;
-    Serial.print("[UPLOAD] Upload path: ");
-    Serial.println(path);
-    
-    // HTTPヘッダー作成（認証付き）
-    String httpRequest = "POST " + path + " HTTP/1.1\r\n";
-    httpRequest += "Host: " + host + "\r\n";
-    httpRequest += "Authorization: Bearer " + String(SUPABASE_SERVICE_KEY_CONST) + "\r\n";
-    httpRequest += "Content-Type: image/jpeg\r\n";
-    httpRequest += "Content-Length: " + String(imageSize) + "\r\n";
-    httpRequest += "x-upsert: true\r\n";
-    httpRequest += "Connection: close\r\n\r\n";
-    
-    Serial.println("[UPLOAD] Sending headers...");
-    
-    // ヘッダー送信
-    client.print(httpRequest);
-    
-    Serial.println("[UPLOAD] Sending image data...");
-    
-    // 画像データを分割して送信（大きなデータの安全な送信）
-    const size_t chunkSize = 1024; // 1KBずつ送信
-    size_t totalSent = 0;
-    
-    while (totalSent < imageSize) {
-        size_t currentChunkSize = min(chunkSize, imageSize - totalSent);
-        size_t bytesWritten = client.write(imageData + totalSent, currentChunkSize);
-        
-        if (bytesWritten != currentChunkSize) {
-            Serial.print("[UPLOAD] Write error at byte ");
-            Serial.print(totalSent);
-            Serial.print(": ");
-            Serial.print(bytesWritten);
-            Serial.print("/");
-            Serial.println(currentChunkSize);
-            client.stop();
-            return false;
-        }
-        
-        totalSent += bytesWritten;
-        
-        // 進捗表示（10%ごと）
-        if ((totalSent * 10 / imageSize) != ((totalSent - bytesWritten) * 10 / imageSize)) {
-            Serial.print("[UPLOAD] Progress: ");
-            Serial.print(totalSent * 100 / imageSize);
-            Serial.println("%");
-        }
-        
-        delay(1); // 少し待機してESP32の負荷を軽減
+    if (shortPressPending) {
+        unsigned long sinceRelease = millis() - shortPressReleaseTime;
+        unsigned long untilSingle = sinceRelease < DOUBLE_PRESS_WINDOW ? DOUBLE_PRESS_WINDOW - sinceRelease : 0;
+        if (untilSingle < waitMs) waitMs = untilSingle;
     }
-    
-    Serial.println("[UPLOAD] Data sent, waiting for response...");
-    
-    // レスポンス読み取り
-    unsigned long timeout = millis();
-    while (client.available() == 0) {
-        if (millis() - timeout > 15000) { // 15秒タイムアウト
-            Serial.println("[UPLOAD] Response timeout!");
-            client.stop();
-            return false;
-        }
-        delay(10);
-    }
-    
-    // HTTPステータスコード確認
-    bool success = false;
-    String statusLine = "";
-    
-    while (client.available()) {
-        String line = client.readStringUntil('\n');
-        line.trim();
-        
-        if (line.startsWith("HTTP/1.1")) {
-            statusLine = line;
-            Serial.print("[UPLOAD] HTTP Response: ");
-            Serial.println(line);
-            
-            if (line.indexOf("200") > 0 || line.indexOf("201") > 0) {
-                success = true;
-            }
-        }
-        
-        // 空行でヘッダー終了
-        if (line.length() == 0) {
-            break;
-        }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs) + 1);
+}
+
+// loop()の待機を解除して状態を再評価させる
+void notifyMainLoop() {
+    if (mainLoopTaskHandle != NULL) {
+        xTaskNotifyGive(mainLoopTaskHandle);
     }
-    
-    // レスポンスボディも読み取り（エラー情報のため）
-    if (!success && client.available()) {
-        Serial.println("[UPLOAD] Error response body:");
-        while (client.available()) {
-            String line = client.readStringUntil('\n');
-            Serial.println(line);
-            if (line.length() > 100) break; // 長すぎる場合は途中で止める
-        }
+}
+
+// 外部ボタンの押下・解放割り込み
+void IRAM_ATTR buttonInterrupt() {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    if (mainLoopTaskHandle != NULL) {
+        vTaskNotifyGiveFromISR(mainLoopTaskHandle, &higherPriorityTaskWoken);
     }
-    
-    client.stop();
-    
-    if (success) {
-        Serial.print("[UPLOAD] Successfully uploaded: ");
-        Serial.println(filename);
-    } else {
-        Serial.println("[UPLOAD] Upload failed - check Supabase configuration");
+    if (higherPriorityTaskWoken) {
+        portYIELD_FROM_ISR();
     }
-    
-    return success;
 }
 
 void handleShutdown() {
-    Serial.println("[SHUTDOWN] Entering deep sleep mode...");
+    LOG_I("[SHUTDOWN] Entering deep sleep mode...");
     
     // システム情報表示
-    Serial.print("[DEBUG] Free heap before shutdown: ");
-    Serial.println(ESP.getFreeHeap());
-    Serial.print("[DEBUG] Uptime before shutdown: ");
-    Serial.print(millis() / 1000);
-    Serial.println(" seconds");
+    LOG_I("[DEBUG] Free heap before shutdown: %lu", (unsigned long)ESP.getFreeHeap());
+    LOG_I("[DEBUG] Uptime before shutdown: %lu seconds", millis() / 1000);
     
     // LED 5回点滅でdeep sleep予告
-    Serial.println("[SHUTDOWN] LED signaling deep sleep...");
-    for(int i = 0; i < 5; i++) {
-        digitalWrite(CAMERA_LED_GPIO, HIGH);
-        delay(200);
-        digitalWrite(CAMERA_LED_GPIO, LOW);
-        delay(200);
-    }
+    LOG_I("[SHUTDOWN] LED signaling deep sleep...");
+    ledBlink(5, 200, 200);
+    
+    // 撮影・アップロード中のタスクを止めてから（未送信のフレームはオフラインキューへ）
+    stopLocalStream();
+    stopCapturePipeline();
+    waitForLedIdle();
     
     // システムクリーンアップ
-    Serial.println("[SHUTDOWN] Cleaning up system...");
+    LOG_I("[SHUTDOWN] Cleaning up system...");
+    closeUploadConnection();
     WiFi.disconnect();
     WiFi.mode(WIFI_OFF);
     TimerCAM.Camera.deinit();
     
-    Serial.println("[SHUTDOWN] System cleanup complete");
-    Serial.flush(); // シリアル出力を確実に送信
+    LOG_I("[SHUTDOWN] System cleanup complete");
+    logFlush(); // シリアル出力を確実に送信
     
     delay(1000); // 1秒待機
     
     // Deep sleep設定
-    Serial.println("[SHUTDOWN] Configuring deep sleep wake-up...");
+    LOG_I("[SHUTDOWN] Configuring deep sleep wake-up...");
     esp_sleep_enable_ext0_wakeup((gpio_num_t)EXTERNAL_BUTTON_GPIO, 0); // GPIO 4がLOWで起動
     
-    Serial.println("[SHUTDOWN] Entering deep sleep... Press external button (GPIO 4) to wake up.");
-    Serial.flush();
+    LOG_I("[SHUTDOWN] Entering deep sleep... Press external button (GPIO 4) to wake up.");
+    logFlush();
     
     delay(500); // 確実にメッセージを送信
     
@@ -0,0 +1,382 @@
+#include "offline_queue.h"
+#include <WiFi.h>
+#include <LittleFS.h>
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "power_stats.h"
+#include "capture_pipeline.h"
+
+// オフラインキュー設定（LittleFSに追記専用インデックスで保存し、再起動後も再送）
+#define OFFLINE_QUEUE_DIR "/queue"
+#define OFFLINE_QUEUE_INDEX "/queue/index.log"
+const int OFFLINE_QUEUE_MAX_ENTRIES = 64;
+const int OFFLINE_DRAIN_BATCH = 8;    // キュー送信で1回にまとめる最大フレーム数
+struct OfflineEntry {
+    uint32_t seq;
+    uint32_t size;
+    char filename[48];
+};
+OfflineEntry offlineQueue[OFFLINE_QUEUE_MAX_ENTRIES];
+int offlineQueueCount = 0;
+uint32_t offlineQueueNextSeq = 1;
+bool offlineQueueReady = false;
+SemaphoreHandle_t offlineQueueMutex = NULL; // 撮影タスクとアップロードタスクからの同時アクセス保護
+
+// オフラインキュー初期化（インデックスを再生して未送信フレームを復元）
+// skipIndex が true の場合はRTCメモリの連番を使い、インデックス読み込みを省略
+bool initOfflineQueue(bool skipIndex) {
+    offlineQueueMutex = xSemaphoreCreateMutex();
+    if (!LittleFS.begin(true)) {
+        LOG_E("[QUEUE] LittleFS mount failed, offline queue disabled");
+        return false;
+    }
+    if (!LittleFS.exists(OFFLINE_QUEUE_DIR)) {
+        LittleFS.mkdir(OFFLINE_QUEUE_DIR);
+    }
+    
+    offlineQueueCount = 0;
+    offlineQueueNextSeq = 1;
+    
+    if (skipIndex) {
+        offlineQueueNextSeq = rtcState.queueNextSeq;
+        offlineQueueReady = true;
+        return true;
+    }
+    
+    File index = LittleFS.open(OFFLINE_QUEUE_INDEX, "r");
+    if (index) {
+        char line[80];
+        while (index.available()) {
+            size_t n = index.readBytesUntil('\n', line, sizeof(line) - 1);
+            line[n] = '\0';
+            
+            unsigned long seq = 0;
+            unsigned long size = 0;
+            char name[48];
+            if (sscanf(line, "A %lu %lu %47s", &seq, &size, name) == 3) {
+                if (offlineQueueCount < OFFLINE_QUEUE_MAX_ENTRIES) {
+                    OfflineEntry& entry = offlineQueue[offlineQueueCount++];
+                    entry.seq = seq;
+                    entry.size = size;
+                    strncpy(entry.filename, name, sizeof(entry.filename) - 1);
+                    entry.filename[sizeof(entry.filename) - 1] = '\0';
+                }
+            } else if (sscanf(line, "D %lu", &seq) == 1) {
+                removeOfflineEntry(seq);
+            }
+            if (seq >= offlineQueueNextSeq) {
+                offlineQueueNextSeq = seq + 1;
+            }
+        }
+        index.close();
+    }
+    
+    offlineQueueReady = true;
+    LOG_I("[QUEUE] Offline queue ready, pending frames: %d", offlineQueueCount);
+    
+    // 全件送信済みのインデックスは削除して肥大化を防ぐ
+    if (offlineQueueCount == 0) {
+        LittleFS.remove(OFFLINE_QUEUE_INDEX);
+    }
+    return true;
+}
+
+// メモリ上のキューからエントリを削除
+void removeOfflineEntry(uint32_t seq) {
+    for (int i = 0; i < offlineQueueCount; i++) {
+        if (offlineQueue[i].seq == seq) {
+            for (int j = i; j < offlineQueueCount - 1; j++) {
+                offlineQueue[j] = offlineQueue[j + 1];
+            }
+            offlineQueueCount--;
+            return;
+        }
+    }
+}
+
+// 追記専用インデックスに1行書き込み
+bool appendOfflineIndex(const char* record) {
+    File index = LittleFS.open(OFFLINE_QUEUE_INDEX, "a");
+    if (!index) {
+        LOG_E("[QUEUE] Failed to open index");
+        return false;
+    }
+    bool ok = index.print(record) == strlen(record);
+    index.close();
+    return ok;
+}
+
+// フレームをオフラインキューに保存（撮影タスク・アップロードタスクの両方から呼ばれる）
+// resume に未完了の再開可能アップロードがあれば、続きから送れるよう一緒に保存
+bool enqueueOfflineFrame(const uint8_t* imageData, size_t imageSize, const char* filename,
+                         const ResumableUpload* resume) {
+    if (!offlineQueueReady) {
+        return false;
+    }
+    
+    xSemaphoreTake(offlineQueueMutex, portMAX_DELAY);
+    bool stored = storeOfflineFrame(imageData, imageSize, filename, resume);
+    xSemaphoreGive(offlineQueueMutex);
+    return stored;
+}
+
+// フレームをファイルに書き込みインデックスに追記（offlineQueueMutex取得済みで呼ぶ）
+bool storeOfflineFrame(const uint8_t* imageData, size_t imageSize, const char* filename,
+                       const ResumableUpload* resume) {
+
+    if (offlineQueueCount >= OFFLINE_QUEUE_MAX_ENTRIES) {
+        LOG_W("[QUEUE] Offline queue full, frame dropped");
+        return false;
+    }
+    
+    // 空き容量確認（インデックス追記分の余裕を残す）
+    if (LittleFS.totalBytes() - LittleFS.usedBytes() < imageSize + 8192) {
+        LOG_W("[QUEUE] Not enough flash space, frame dropped");
+        return false;
+    }
+    
+    uint32_t seq = offlineQueueNextSeq++;
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%lu.jpg", OFFLINE_QUEUE_DIR, (unsigned long)seq);
+    
+    // データを書き込んでからインデックスに追記（途中で電源断しても整合性を保つ）
+    File file = LittleFS.open(path, "w");
+    if (!file) {
+        LOG_E("[QUEUE] Failed to create frame file");
+        return false;
+    }
+    size_t written = file.write(imageData, imageSize);
+    file.close();
+    if (written != imageSize) {
+        LOG_E("[QUEUE] Frame write failed");
+        LittleFS.remove(path);
+        return false;
+    }
+    
+    char record[80];
+    snprintf(record, sizeof(record), "A %lu %lu %s\n", (unsigned long)seq, (unsigned long)imageSize, filename);
+    if (!appendOfflineIndex(record)) {
+        LittleFS.remove(path);
+        return false;
+    }
+    
+    OfflineEntry& entry = offlineQueue[offlineQueueCount++];
+    entry.seq = seq;
+    entry.size = imageSize;
+    strncpy(entry.filename, filename, sizeof(entry.filename) - 1);
+    entry.filename[sizeof(entry.filename) - 1] = '\0';
+    
+    if (resume != nullptr && resume->location[0] != '\0') {
+        ResumableUpload queued = *resume;
+        queued.queueSeq = seq;
+        saveResumableState(queued);
+    }
+    
+    LOG_I("[QUEUE] Frame queued: %s (pending: %d)", filename, offlineQueueCount);
+    return true;
+}
+
+// 送信済み（または送信不能）エントリをキューから外す
+void completeOfflineEntry(uint32_t seq) {
+    xSemaphoreTake(offlineQueueMutex, portMAX_DELAY);
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%lu.jpg", OFFLINE_QUEUE_DIR, (unsigned long)seq);
+    LittleFS.remove(path);
+    snprintf(path, sizeof(path), "%s/%lu.tus", OFFLINE_QUEUE_DIR, (unsigned long)seq);
+    if (LittleFS.exists(path)) {
+        LittleFS.remove(path);
+    }
+    
+    char record[24];
+    snprintf(record, sizeof(record), "D %lu\n", (unsigned long)seq);
+    appendOfflineIndex(record);
+    removeOfflineEntry(seq);
+    
+    if (offlineQueueCount == 0) {
+        LittleFS.remove(OFFLINE_QUEUE_INDEX);
+    }
+    xSemaphoreGive(offlineQueueMutex);
+}
+
+// 再開可能アップロードの進捗を初期化
+void initResumableUpload(ResumableUpload& resume, uint32_t queueSeq) {
+    resume.queueSeq = queueSeq;
+    resume.offset = 0;
+    resume.location[0] = '\0';
+}
+
+// キュー内フレームの再開可能アップロードの進捗を読み込む（なければ false）
+// 形式: "<受信確認済みバイト数> <アップロードURLのパス>"
+bool loadResumableState(ResumableUpload& resume) {
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%lu.tus", OFFLINE_QUEUE_DIR, (unsigned long)resume.queueSeq);
+    if (!LittleFS.exists(path)) {
+        return false;
+    }
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[sizeof(resume.location) + 16];
+    size_t n = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    file.close();
+    line[n] = '\0';
+    
+    unsigned long offset = 0;
+    char location[sizeof(resume.location)];
+    if (sscanf(line, "%lu %191s", &offset, location) != 2) {
+        return false;
+    }
+    resume.offset = offset;
+    strcpy(resume.location, location);
+    return true;
+}
+
+// キュー内フレームの進捗を保存（PATCHの受信確認ごと、キュー外のフレームは保存しない）
+void saveResumableState(const ResumableUpload& resume) {
+    if (resume.queueSeq == 0 || !offlineQueueReady) {
+        return;
+    }
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%lu.tus", OFFLINE_QUEUE_DIR, (unsigned long)resume.queueSeq);
+    File file = LittleFS.open(path, "w");
+    if (!file) {
+        return;
+    }
+    file.printf("%lu %s\n", (unsigned long)resume.offset, resume.location);
+    file.close();
+}
+
+// 未送信フレームを1回の無線セッションでまとめて送信（keep-alive接続を再利用）
+// バッテリー残量か時間予算が尽きた時点で中断し、残りは次回に持ち越す
+void drainOfflineQueue(uint8_t* buffer, size_t bufferSize) {
+    if (!offlineQueueReady || offlineQueueCount == 0) {
+        return;
+    }
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    // 電池残量が危険域の間は充電されるまで送信しない
+    if (shouldDeferUploads()) {
+        return;
+    }
+    // サーバーの指示した待機時間が過ぎるまで送信しない
+    if (isServerBackingOff()) {
+        return;
+    }
+    
+    LOG_I("[QUEUE] Draining offline queue, pending frames: %d", offlineQueueCount);
+    
+    unsigned long drainStart = millis();
+    int uploaded = 0;
+    
+    while (offlineQueueCount > 0) {
+        // 新しく撮影されたフレームを優先（シャットダウン中は打ち切り）
+        if (pipelineRunning && (slotRingCount(readySlotRing) > 0 || pipelineStopping)) {
+            break;
+        }
+        if (millis() - drainStart > OFFLINE_DRAIN_TIME_BUDGET) {
+            LOG_W("[QUEUE] Drain time budget exhausted");
+            break;
+        }
+        // 電池なし（USB給電のみ）で測定値が使えない場合は残量で止めない
+        samplePower();
+        int batteryLevel = powerSnapshot().batteryLevel;
+        if (isBatteryReadingValid() && batteryLevel < OFFLINE_DRAIN_MIN_BATTERY) {
+            LOG_W("[QUEUE] Battery too low for drain: %d%%", batteryLevel);
+            break;
+        }
+        
+        // バッファに収まる分だけ読み出して1バッチにする
+        OfflineEntry batchEntries[OFFLINE_DRAIN_BATCH];
+        UploadItem items[OFFLINE_DRAIN_BATCH];
+        ResumableUpload resumes[OFFLINE_DRAIN_BATCH];
+        int batchCount = 0;
+        size_t bufferUsed = 0;
+        
+        xSemaphoreTake(offlineQueueMutex, portMAX_DELAY);
+        int available = min(offlineQueueCount, OFFLINE_DRAIN_BATCH);
+        for (int i = 0; i < available; i++) {
+            batchEntries[i] = offlineQueue[i];
+        }
+        xSemaphoreGive(offlineQueueMutex);
+        
+        for (int i = 0; i < available; i++) {
+            const OfflineEntry& entry = batchEntries[i];
+            if (entry.size > bufferSize - bufferUsed) {
+                break;
+            }
+            
+            char path[32];
+            snprintf(path, sizeof(path), "%s/%lu.jpg", OFFLINE_QUEUE_DIR, (unsigned long)entry.seq);
+            
+            File file = LittleFS.open(path, "r");
+            if (!file || file.read(buffer + bufferUsed, entry.size) != entry.size) {
+                LOG_W("[QUEUE] Unreadable queued frame, discarding: %s", entry.filename);
+                if (file) file.close();
+                completeOfflineEntry(entry.seq);
+                continue;
+            }
+            file.close();
+            
+            batchEntries[batchCount] = entry;
+            items[batchCount].data = buffer + bufferUsed;
+            items[batchCount].size = entry.size;
+            items[batchCount].filename = batchEntries[batchCount].filename;
+            items[batchCount].statusCode = 0;
+            items[batchCount].resume = &resumes[batchCount];
+            initResumableUpload(resumes[batchCount], entry.seq);
+            if (loadResumableState(resumes[batchCount])) {
+                LOG_I("[QUEUE] Resuming partial upload: %s", entry.filename);
+            }
+            bufferUsed += entry.size;
+            batchCount++;
+        }
+        
+        if (batchCount == 0) {
+            // 先頭がバッファに収まらない場合は破棄（読み出し不能分は破棄済み）
+            if (available > 0 && batchEntries[0].size > bufferSize) {
+                LOG_W("[QUEUE] Queued frame larger than drain buffer, discarding");
+                completeOfflineEntry(batchEntries[0].seq);
+            }
+            continue;
+        }
+        
+        uploadBatchToSupabase(items, batchCount);
+        
+        bool keepDraining = true;
+        for (int i = 0; i < batchCount; i++) {
+            int statusCode = items[i].statusCode;
+            if (statusCode == 200 || statusCode == 201) {
+                completeOfflineEntry(batchEntries[i].seq);
+                uploaded++;
+            } else if (statusCode >= 400 && statusCode < 500 && statusCode != 429) {
+                // 4xx（429を除く）は再送しても成功しないため破棄
+                LOG_W("[QUEUE] Frame rejected by server, discarding: %s", batchEntries[i].filename);
+                completeOfflineEntry(batchEntries[i].seq);
+            } else {
+                keepDraining = false;
+            }
+        }
+        if (!keepDraining) {
+            LOG_W("[QUEUE] Upload failed, keeping remaining frames for later");
+            break;
+        }
+    }
+    
+    LOG_I("[QUEUE] Drain finished, uploaded: %d, remaining: %d", uploaded, offlineQueueCount);
+}
+
+// アップロードタスクにオフラインキューの送信を依頼
+void requestOfflineDrain() {
+    if (!offlineQueueReady || offlineQueueCount == 0) {
+        return;
+    }
+    if (pipelineRunning) {
+        offlineDrainRequested = true;
+        xTaskNotifyGive(uploadTaskHandle);
+    } else if (drainBuffer != nullptr) {
+        drainOfflineQueue(drainBuffer, MAX_FRAME_SIZE);
+    }
+}
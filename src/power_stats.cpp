@@ -0,0 +1,177 @@
+#include "power_stats.h"
+#include "M5TimerCAM.h"
+#include "esp_timer.h"
+#include "time.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "time_sync.h"
+
+const char* const PHASE_NAMES[PHASE_COUNT] = {"cam", "warm", "cap", "wifi", "tls", "send", "resp", "awake"};
+RTC_DATA_ATTR PhaseStats phaseStats[PHASE_COUNT];
+
+RTC_DATA_ATTR PowerState powerState = {0, -1, 0, 0, 0, 0, 0, 0};
+
+// フェーズの所要時間を記録（startUs は esp_timer_get_time() の開始値）
+void recordPhase(ShotPhase phase, int64_t startUs) {
+    uint32_t elapsedUs = (uint32_t)(esp_timer_get_time() - startUs);
+    portENTER_CRITICAL(&stateMux);
+    updatePhaseStats(phaseStats[phase], elapsedUs);
+    
+    // 電荷推定用に前回の推定以降の時間を積算
+    uint32_t elapsedMs = elapsedUs / 1000;
+    if (phase == PHASE_CAMERA_INIT || phase == PHASE_WARMUP || phase == PHASE_CAPTURE) {
+        powerState.pendingCameraMs += elapsedMs;
+    } else if (phase == PHASE_AWAKE) {
+        powerState.pendingAwakeMs += elapsedMs;
+    } else {
+        powerState.pendingRadioMs += elapsedMs;
+    }
+    portEXIT_CRITICAL(&stateMux);
+}
+
+// 直近の各フェーズ時間を "cap=120;wifi=350;..."（ミリ秒）形式で出力
+void formatPhaseSummary(char* out, size_t outSize) {
+    PhaseStats stats[PHASE_COUNT];
+    portENTER_CRITICAL(&stateMux);
+    memcpy(stats, phaseStats, sizeof(stats));
+    portEXIT_CRITICAL(&stateMux);
+    
+    size_t used = 0;
+    out[0] = '\0';
+    for (int i = 0; i < PHASE_COUNT && used < outSize; i++) {
+        if (stats[i].count == 0) continue;
+        int n = snprintf(out + used, outSize - used, "%s%s=%lu", used > 0 ? ";" : "",
+                         PHASE_NAMES[i], (unsigned long)(stats[i].lastUs / 1000));
+        if (n < 0) break;
+        used += n;
+    }
+}
+
+// フェーズ別統計を表示（ミリ秒）
+void printPhaseStats() {
+    PhaseStats snapshot[PHASE_COUNT];
+    portENTER_CRITICAL(&stateMux);
+    memcpy(snapshot, phaseStats, sizeof(snapshot));
+    portEXIT_CRITICAL(&stateMux);
+    
+    LOG_I("[TIMING] phase: last/min/avg/max ms (count)");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats& stats = snapshot[i];
+        if (stats.count == 0) continue;
+        LOG_I("[TIMING] %-5s: %lu/%lu/%lu/%lu (%lu)", PHASE_NAMES[i],
+              (unsigned long)(stats.lastUs / 1000), (unsigned long)(stats.minUs / 1000),
+              (unsigned long)(stats.avgUs / 1000), (unsigned long)(stats.maxUs / 1000),
+              (unsigned long)stats.count);
+    }
+}
+
+// 電池電圧と残量を読み取る（無線の送信負荷がない撮影前に測るのが望ましい）
+void samplePower() {
+    int16_t batteryMv = TimerCAM.Power.getBatteryVoltage();
+    int8_t batteryLevel = TimerCAM.Power.getBatteryLevel();
+    portENTER_CRITICAL(&stateMux);
+    powerState.batteryMv = batteryMv;
+    powerState.batteryLevel = batteryLevel;
+    portEXIT_CRITICAL(&stateMux);
+}
+
+// 電源状態の一貫したコピー（他のタスクが更新中でも項目が混ざらない）
+PowerState powerSnapshot() {
+    portENTER_CRITICAL(&stateMux);
+    PowerState snapshot = powerState;
+    portEXIT_CRITICAL(&stateMux);
+    return snapshot;
+}
+
+// 前回以降のフェーズ時間から1撮影あたりの消費を推定し、目標稼働日数に収まる撮影間隔を求める
+void updatePowerBudget() {
+    samplePower();
+    
+    // 電荷 = 電流 × 時間（mA × ms / 3600 = µAh）。Deep sleep運用では起動中の残り時間も加える
+    portENTER_CRITICAL(&stateMux);
+    uint32_t cameraMs = powerState.pendingCameraMs;
+    uint32_t radioMs = powerState.pendingRadioMs;
+    uint32_t awakeMs = powerState.pendingAwakeMs;
+    uint32_t idleMs = awakeMs > cameraMs + radioMs ? awakeMs - cameraMs - radioMs : 0;
+    powerState.pendingCameraMs = 0;
+    powerState.pendingRadioMs = 0;
+    powerState.pendingAwakeMs = 0;
+    if (cameraMs > 0 || radioMs > 0) {
+        uint32_t cycleUAh = ((uint64_t)cameraMs * POWER_CAMERA_MA + (uint64_t)radioMs * POWER_RADIO_MA +
+                             (uint64_t)idleMs * POWER_IDLE_MA) / 3600;
+        powerState.shotUAh = powerState.shotUAh == 0 ? cycleUAh
+                                                     : powerState.shotUAh - powerState.shotUAh / 4 + cycleUAh / 4;
+    }
+    portEXIT_CRITICAL(&stateMux);
+    
+#if BATTERY_TARGET_DAYS > 0
+    PowerState power = powerSnapshot();
+    // 電池電圧が読めない（USB給電のみ）・時刻未設定の場合は調整しない
+    if (!isBatteryReadingValid() || !isTimeValid() || power.shotUAh == 0) {
+        portENTER_CRITICAL(&stateMux);
+        powerState.intervalSec = 0;
+        portEXIT_CRITICAL(&stateMux);
+        return;
+    }
+    
+    // 満充電のたびに目標期間を設定し直す（目標期間・撮影間隔を書くのはこの関数だけ）
+    time_t now = time(nullptr);
+    if (power.batteryLevel >= 95 || power.targetEndEpoch == 0) {
+        power.targetEndEpoch = now + (time_t)BATTERY_TARGET_DAYS * 86400;
+    }
+    
+    // 残りの電荷から待機中の消費を除いた分で、何回撮影できるかを求める
+    uint32_t secondsLeft = power.targetEndEpoch > now + 86400 ? power.targetEndEpoch - now : 86400;
+    uint64_t remainingUAh = (uint64_t)BATTERY_CAPACITY_MAH * 1000 * power.batteryLevel / 100;
+    uint64_t sleepUAh = (uint64_t)POWER_SLEEP_UA * secondsLeft / 3600;
+    uint32_t minInterval = settings.photoIntervalSec;
+    uint32_t maxInterval = settings.photoIntervalSec * BATTERY_MAX_INTERVAL_SCALE;
+    uint32_t interval = maxInterval;
+    if (remainingUAh > sleepUAh) {
+        uint64_t shots = (remainingUAh - sleepUAh) / power.shotUAh;
+        interval = shots > 0 ? secondsLeft / shots : maxInterval;
+    }
+    interval = constrain(interval, minInterval, maxInterval);
+    
+    if (interval != effectiveIntervalSec()) {
+        LOG_I("[POWER] Interval %lu -> %lu s (battery %d%%, %d mV, %lu uAh/shot, %lu days left)",
+              (unsigned long)effectiveIntervalSec(), (unsigned long)interval,
+              power.batteryLevel, power.batteryMv, (unsigned long)power.shotUAh,
+              (unsigned long)(secondsLeft / 86400));
+    }
+    portENTER_CRITICAL(&stateMux);
+    powerState.targetEndEpoch = power.targetEndEpoch;
+    powerState.intervalSec = interval == minInterval ? 0 : interval;
+    portEXIT_CRITICAL(&stateMux);
+#endif
+}
+
+// 電池の測定値が使えるか（USB給電のみで電池がない場合は電圧が極端に低く、残量は意味を持たない）
+bool isBatteryReadingValid() {
+    PowerState power = powerSnapshot();
+    return power.batteryMv >= 2500 && power.batteryLevel >= 0;
+}
+
+// 電池残量が危険域ならアップロード（無線）を見送り、充電されるまでオフラインキューに保存
+bool shouldDeferUploads() {
+    return isBatteryReadingValid() && powerSnapshot().batteryLevel < BATTERY_DEFER_LEVEL;
+}
+
+// 実際に使う撮影間隔（電池の目標稼働日数に合わせて延ばした値）
+uint32_t effectiveIntervalSec() {
+    uint32_t intervalSec = powerSnapshot().intervalSec;
+    return intervalSec > settings.photoIntervalSec ? intervalSec : settings.photoIntervalSec;
+}
+
+// 電池テレメトリを "mv=3950;pct=78;uah=120;int=3600" 形式で出力
+void formatPowerSummary(char* out, size_t outSize) {
+    out[0] = '\0';
+    PowerState power = powerSnapshot();
+    if (power.batteryLevel < 0) {
+        return;
+    }
+    snprintf(out, outSize, "mv=%d;pct=%d;uah=%lu;int=%lu", power.batteryMv, power.batteryLevel,
+             (unsigned long)power.shotUAh, (unsigned long)effectiveIntervalSec());
+}
@@ -0,0 +1,199 @@
+#include "runtime_settings.h"
+#include <Preferences.h>
+#include "time.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "power_stats.h"
+#include "camera_capture.h"
+#include "wifi_link.h"
+#include "supabase_upload.h"
+
+// タイマー撮影設定（config.hの値が初期値、実行時設定で変更可能）
+// タイムラプス指定時は秒単位の間隔を優先
+const uint32_t DEFAULT_PHOTO_INTERVAL_SEC = TIMELAPSE_INTERVAL_SEC > 0
+    ? TIMELAPSE_INTERVAL_SEC
+    : PHOTO_INTERVAL_HOURS * 3600UL;
+
+RuntimeSettings settings;
+char remoteConfigEtag[64] = "";  // 前回取得したリモート設定のETag
+RTC_DATA_ATTR uint32_t lastConfigCheckEpoch = 0;
+
+// 設定読み込み関数（config.hから設定を読み込み）
+void loadEnvironmentVariables() {
+    LOG_I("[CONFIG] Loading configuration from config.h");
+    LOG_I("[CONFIG] WiFi SSID: %s", ssid);
+    LOG_I("[CONFIG] Supabase URL: %s", CONFIG.supabaseUrl);
+    LOG_I("[CONFIG] Bucket Name: %s", settings.bucket);
+    LOG_I("[CONFIG] Photo Interval: %lu sec", (unsigned long)settings.photoIntervalSec);
+}
+
+// 実行時設定をNVSから読み込む（未保存の項目はconfig.hの値）
+void loadRuntimeSettings() {
+    settings.photoIntervalSec = DEFAULT_PHOTO_INTERVAL_SEC;
+    strncpy(settings.bucket, CONFIG.defaultBucket, sizeof(settings.bucket) - 1);
+    settings.bucket[sizeof(settings.bucket) - 1] = '\0';
+    settings.encoderBestLevel = ENCODER_BEST_LEVEL;
+    settings.uploadChunkSize = UPLOAD_CHUNK_SIZE;
+    settings.maxWifiRetry = 3;
+    settings.lightSleepMs = 30000;
+    settings.awakeGraceMs = DEEP_SLEEP_AWAKE_GRACE;
+    settings.motionThreshold = MOTION_THRESHOLD;
+    
+    Preferences prefs;
+    if (prefs.begin("settings", true)) {
+        settings.photoIntervalSec = prefs.getUInt("interval_s", settings.photoIntervalSec);
+        prefs.getString("bucket", settings.bucket, sizeof(settings.bucket));
+        settings.encoderBestLevel = prefs.getUChar("enc_best", settings.encoderBestLevel);
+        settings.uploadChunkSize = prefs.getUInt("chunk", settings.uploadChunkSize);
+        settings.maxWifiRetry = prefs.getUChar("wifi_retry", settings.maxWifiRetry);
+        settings.lightSleepMs = prefs.getUInt("lsleep_ms", settings.lightSleepMs);
+        settings.awakeGraceMs = prefs.getUInt("awake_ms", settings.awakeGraceMs);
+        settings.motionThreshold = prefs.getUChar("motion_thr", settings.motionThreshold);
+        prefs.getString("cfg_etag", remoteConfigEtag, sizeof(remoteConfigEtag));
+        prefs.end();
+    }
+    sanitizeRuntimeSettings();
+}
+
+// 範囲外の値を補正（誤った設定で撮影・送信が止まらないように）
+void sanitizeRuntimeSettings() {
+    settings.photoIntervalSec = constrain(settings.photoIntervalSec, 5UL, 86400UL);
+    if (settings.bucket[0] == '\0') {
+        strncpy(settings.bucket, CONFIG.defaultBucket, sizeof(settings.bucket) - 1);
+    }
+    if (settings.encoderBestLevel >= ENCODER_LEVEL_COUNT) {
+        settings.encoderBestLevel = ENCODER_DEFAULT_LEVEL;
+    }
+    settings.uploadChunkSize = constrain(settings.uploadChunkSize, 1024UL, 16384UL);
+    settings.maxWifiRetry = constrain(settings.maxWifiRetry, 1, 10);
+    settings.lightSleepMs = constrain(settings.lightSleepMs, 1000UL, 600000UL);
+    settings.awakeGraceMs = constrain(settings.awakeGraceMs, 0UL, 3600000UL);
+    settings.motionThreshold = constrain(settings.motionThreshold, 1, 127);
+}
+
+// 実行時設定をNVSに保存
+bool saveRuntimeSettings() {
+    Preferences prefs;
+    if (!prefs.begin("settings", false)) {
+        LOG_E("[CONFIG] NVS open failed, settings not saved");
+        return false;
+    }
+    prefs.putUInt("interval_s", settings.photoIntervalSec);
+    prefs.putString("bucket", settings.bucket);
+    prefs.putUChar("enc_best", settings.encoderBestLevel);
+    prefs.putUInt("chunk", settings.uploadChunkSize);
+    prefs.putUChar("wifi_retry", settings.maxWifiRetry);
+    prefs.putUInt("lsleep_ms", settings.lightSleepMs);
+    prefs.putUInt("awake_ms", settings.awakeGraceMs);
+    prefs.putUChar("motion_thr", settings.motionThreshold);
+    prefs.putString("cfg_etag", remoteConfigEtag);
+    prefs.end();
+    return true;
+}
+
+unsigned long photoIntervalMs() {
+    return effectiveIntervalSec() * 1000UL;
+}
+
+// リモート設定を適用してNVSに保存（含まれている項目のみ変更）
+// 例: {"interval_s": 3600, "enc_best": 2, "chunk": 16384, "wifi_retry": 3,
+//      "lsleep_ms": 30000, "awake_ms": 60000, "motion_thr": 3, "bucket": "photos"}
+bool applyRemoteConfig(const char* json) {
+    RuntimeSettings previous = settings;
+    long value;
+    if (jsonGetInt(json, "interval_s", value) && value > 0) settings.photoIntervalSec = value;
+    if (jsonGetInt(json, "enc_best", value) && value >= 0) settings.encoderBestLevel = value;
+    if (jsonGetInt(json, "chunk", value) && value > 0) settings.uploadChunkSize = value;
+    if (jsonGetInt(json, "wifi_retry", value) && value > 0) settings.maxWifiRetry = value;
+    if (jsonGetInt(json, "lsleep_ms", value) && value > 0) settings.lightSleepMs = value;
+    if (jsonGetInt(json, "awake_ms", value) && value >= 0) settings.awakeGraceMs = value;
+    if (jsonGetInt(json, "motion_thr", value) && value > 0) settings.motionThreshold = value;
+    jsonGetString(json, "bucket", settings.bucket, sizeof(settings.bucket));
+    sanitizeRuntimeSettings();
+    
+    // 構造体のパディングは不定のため memcmp ではなく項目ごとに比較
+    if (previous.photoIntervalSec == settings.photoIntervalSec &&
+        strcmp(previous.bucket, settings.bucket) == 0 &&
+        previous.encoderBestLevel == settings.encoderBestLevel &&
+        previous.uploadChunkSize == settings.uploadChunkSize &&
+        previous.maxWifiRetry == settings.maxWifiRetry &&
+        previous.lightSleepMs == settings.lightSleepMs &&
+        previous.awakeGraceMs == settings.awakeGraceMs &&
+        previous.motionThreshold == settings.motionThreshold) {
+        return false;
+    }
+    
+    LOG_I("[CONFIG] Remote settings applied: interval %lu s, encoder %u, chunk %lu, wifi retry %u, "
+          "light sleep %lu ms, awake %lu ms, motion %u, bucket %s",
+          (unsigned long)settings.photoIntervalSec, settings.encoderBestLevel,
+          (unsigned long)settings.uploadChunkSize, settings.maxWifiRetry,
+          (unsigned long)settings.lightSleepMs, (unsigned long)settings.awakeGraceMs,
+          settings.motionThreshold, settings.bucket);
+    if (strcmp(previous.bucket, settings.bucket) != 0) {
+        initUploadRequestTemplate();
+    }
+    return true;
+}
+
+// アップロード後の接続を使って定期的にリモート設定を確認
+// If-None-Match で前回のETagを送り、変更がなければ304のみで終わらせる
+void maybeFetchRemoteConfig() {
+#if REMOTE_CONFIG_ENABLED
+    uint32_t now = (uint32_t)time(nullptr);
+    if (lastConfigCheckEpoch != 0 && now - lastConfigCheckEpoch < REMOTE_CONFIG_INTERVAL_SEC) {
+        return;
+    }
+    if (!uploadClientOpen) {
+        return; // 設定取得のためだけに接続はしない
+    }
+    portENTER_CRITICAL(&stateMux);
+    lastConfigCheckEpoch = now;
+    portEXIT_CRITICAL(&stateMux);
+    
+    char etagHeader[sizeof("If-None-Match: \r\n") + sizeof(remoteConfigEtag)] = "";
+    if (remoteConfigEtag[0] != '\0') {
+        snprintf(etagHeader, sizeof(etagHeader), "If-None-Match: %s\r\n", remoteConfigEtag);
+    }
+    int requestLength = snprintf(uploadRequestBuffer, sizeof(uploadRequestBuffer),
+                                 "GET /storage/v1/object/%s/" REMOTE_CONFIG_PATH " HTTP/1.1\r\n"
+                                 "Host: %s\r\n"
+                                 "%s"
+                                 "%s"
+                                 "Connection: keep-alive\r\n\r\n",
+                                 settings.bucket, supabaseHost, SUPABASE_AUTH_HEADER, etagHeader);
+    if (requestLength <= 0 || requestLength >= (int)sizeof(uploadRequestBuffer)) {
+        return;
+    }
+    if (uploadClient.write((const uint8_t*)uploadRequestBuffer, requestLength) != (size_t)requestLength) {
+        closeUploadConnection();
+        return;
+    }
+    
+    char body[512];
+    ResponseCapture capture = {body, sizeof(body), 0, "", "", -1, false};
+    body[0] = '\0';
+    int statusCode = readUploadResponse(&capture);
+    if (statusCode == 0) {
+        return;
+    }
+    uploadClientRequests++;
+    
+    if (statusCode == 304) {
+        LOG_I("[CONFIG] Remote settings unchanged");
+    } else if (statusCode == 200 && capture.bodyTruncated) {
+        // 切り詰めた本文では一部の項目を読み落とすため適用しない（ETagも更新せず次回また確認）
+        LOG_W("[CONFIG] Remote settings larger than %u bytes, ignored", (unsigned int)(sizeof(body) - 1));
+    } else if (statusCode == 200) {
+        bool changed = applyRemoteConfig(body);
+        strncpy(remoteConfigEtag, capture.etag, sizeof(remoteConfigEtag) - 1);
+        remoteConfigEtag[sizeof(remoteConfigEtag) - 1] = '\0';
+        saveRuntimeSettings();
+        if (!changed) {
+            LOG_I("[CONFIG] Remote settings match current settings");
+        }
+    } else {
+        LOG_I("[CONFIG] Remote settings not available, status: %d", statusCode);
+    }
+#endif
+}
@@ -0,0 +1,138 @@
+#include "shot_schedule.h"
+#include "M5TimerCAM.h"
+#include <WiFi.h>
+#include "esp_sleep.h"
+#include "time.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+#include "time_sync.h"
+#include "offline_queue.h"
+#include "status_led.h"
+#include "supabase_upload.h"
+
+// Light Sleep関数
+void enterLightSleep() {
+    LOG_I("[SLEEP] Entering light sleep for %lu seconds...", (unsigned long)(settings.lightSleepMs / 1000));
+    logFlush();
+    waitForLedIdle();
+    
+    // WiFiを一時的に無効化
+    WiFi.setSleep(true);
+    
+    // Light Sleep実行
+    esp_sleep_enable_timer_wakeup(settings.lightSleepMs * 1000ULL);
+    esp_light_sleep_start();
+    
+    LOG_I("[SLEEP] Woke up from light sleep");
+    
+    // WiFiを再有効化
+    WiFi.setSleep(false);
+}
+
+// MACアドレスのハッシュ（FNV-1a、端末ごとに固定で、起動のたびに変わらない）
+uint32_t deviceHash() {
+    static uint32_t hash = 0;
+    if (hash == 0) {
+        uint8_t mac[6] = {0};
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        hash = 2166136261u;
+        for (int i = 0; i < 6; i++) {
+            hash = (hash ^ mac[i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+// 撮影枠内での端末ごとのオフセット（秒）。台数が多くても送信が枠の先頭に集中しない
+uint32_t fleetSlotOffsetSec(uint32_t interval) {
+    return slotOffsetSec(deviceHash(), interval, FLEET_SLOT_SPREAD_SEC);
+}
+
+// 次回撮影時刻を前回の予定時刻から計算（遅れていても間隔の位相を保つ）
+// 時刻が分かっていれば壁時計の区切り＋端末ごとのオフセットに揃え、起動時刻が揃った端末も分散させる
+// afterShot は撮影直後の呼び出し（撮影した枠をもう一度予定しない）
+void scheduleNextShot(bool afterShot) {
+    time_t now = time(nullptr);
+    time_t interval = effectiveIntervalSec();
+    
+    if (FLEET_SLOT_SPREAD_SEC > 0 && isTimeValid()) {
+        time_t next = nextShotSlot(now, interval, fleetSlotOffsetSec(interval), afterShot);
+        portENTER_CRITICAL(&stateMux);
+        rtcState.nextShotEpoch = next;
+        portEXIT_CRITICAL(&stateMux);
+        return;
+    }
+    portENTER_CRITICAL(&stateMux);
+    if (rtcState.nextShotEpoch == 0) {
+        rtcState.nextShotEpoch = now + interval;
+    }
+    if (rtcState.nextShotEpoch <= now) {
+        rtcState.nextShotEpoch += ((now - rtcState.nextShotEpoch) / interval + 1) * interval;
+    }
+    portEXIT_CRITICAL(&stateMux);
+}
+
+// 時刻が分かった時点で次回撮影を撮影枠に揃える（時刻未設定なら起動基準のまま）
+void alignShotSchedule(bool afterShot) {
+    if (FLEET_SLOT_SPREAD_SEC == 0 || !isTimeValid()) {
+        return;
+    }
+#if DEEP_SLEEP_TIMER_MODE
+    scheduleNextShot(afterShot);
+#else
+    // loop()は millis() 基準のため、次の枠でちょうど間隔に達するよう前回撮影時刻をずらす
+    // （millis()からの経過で表せるのは1周期までのため、それより先の枠は1周期後に撮影）
+    time_t now = time(nullptr);
+    uint32_t interval = effectiveIntervalSec();
+    time_t next = nextShotSlot(now, interval, fleetSlotOffsetSec(interval), afterShot);
+    time_t untilNext = min(next - now, (time_t)interval);
+    lastPhotoTime = millis() + (unsigned long)untilNext * 1000 - photoIntervalMs();
+#endif
+}
+
+// 撮影予定時刻に達したか
+bool isShotDue() {
+    return rtcState.nextShotEpoch != 0 && time(nullptr) >= rtcState.nextShotEpoch;
+}
+
+// 次回撮影までの残り時間（ミリ秒）
+unsigned long millisUntilNextShot() {
+#if DEEP_SLEEP_TIMER_MODE
+    time_t now = time(nullptr);
+    if (rtcState.nextShotEpoch <= now) return 0;
+    return (unsigned long)(rtcState.nextShotEpoch - now) * 1000;
+#else
+    unsigned long elapsed = millis() - lastPhotoTime;
+    return elapsed >= photoIntervalMs() ? 0 : photoIntervalMs() - elapsed;
+#endif
+}
+
+// 次回撮影時刻までDeep sleep（タイマーと外部ボタンで復帰）
+void enterTimerDeepSleep() {
+    time_t now = time(nullptr);
+    uint64_t sleepSeconds = rtcState.nextShotEpoch > now ? rtcState.nextShotEpoch - now : 1;
+    
+    // オフラインキューの状態を保存（復帰時にインデックス読み込みを省略するため）
+    rtcState.queuePending = offlineQueueCount;
+    rtcState.queueNextSeq = offlineQueueNextSeq;
+    
+    // 起動からの稼働時間を記録（esp_timerは起動時に0から始まる）
+    recordPhase(PHASE_AWAKE, 0);
+    printPhaseStats();
+    
+    LOG_I("[SLEEP] Deep sleep until next photo: %lu seconds", (unsigned long)sleepSeconds);
+    logFlush();
+    
+    closeUploadConnection();
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+    TimerCAM.Camera.deinit();
+    waitForLedIdle();
+    
+    esp_sleep_enable_timer_wakeup(sleepSeconds * 1000000ULL);
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)EXTERNAL_BUTTON_GPIO, 0); // GPIO 4がLOWで起動
+    esp_deep_sleep_start();
+}
@@ -0,0 +1,80 @@
+#include "status_led.h"
+#include <atomic>
+#include "app_config.h"
+
+QueueHandle_t ledQueue = NULL;
+TaskHandle_t ledTaskHandle = NULL;
+std::atomic<bool> ledTaskBusy(false);
+
+// LEDタスク起動（失敗時は各パターンを呼び出し元でその場で再生）
+bool startLedTask() {
+    ledQueue = xQueueCreate(8, sizeof(LedCommand));
+    if (ledQueue == NULL) {
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(ledTask, "led", 2048, NULL, 1, &ledTaskHandle, 1) != pdPASS) {
+        vQueueDelete(ledQueue);
+        ledQueue = NULL;
+        return false;
+    }
+    return true;
+}
+
+// LEDタスク: キューのパターンを順に再生（待ち時間はvTaskDelayでCPUを解放）
+void ledTask(void* param) {
+    LedCommand command;
+    for (;;) {
+        if (xQueueReceive(ledQueue, &command, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        runLedCommand(command);
+        if (uxQueueMessagesWaiting(ledQueue) == 0) {
+            ledTaskBusy = false;
+        }
+    }
+}
+
+// パターン1件を再生（点滅後は消灯）
+void runLedCommand(const LedCommand& command) {
+    if (command.blinks == 0) {
+        digitalWrite(CAMERA_LED_GPIO, command.on ? HIGH : LOW);
+        return;
+    }
+    for (int i = 0; i < command.blinks; i++) {
+        digitalWrite(CAMERA_LED_GPIO, HIGH);
+        vTaskDelay(pdMS_TO_TICKS(command.onMs));
+        digitalWrite(CAMERA_LED_GPIO, LOW);
+        if (command.offMs > 0) {
+            vTaskDelay(pdMS_TO_TICKS(command.offMs));
+        }
+    }
+}
+
+void postLedCommand(const LedCommand& command) {
+    if (ledQueue != NULL) {
+        ledTaskBusy = true;
+        if (xQueueSend(ledQueue, &command, 0) == pdTRUE) {
+            return;
+        }
+    }
+    runLedCommand(command);
+}
+
+// LEDの点灯・消灯
+void ledSet(bool on) {
+    LedCommand command = {0, on, 0, 0};
+    postLedCommand(command);
+}
+
+// LEDの点滅（呼び出し元は待たずに戻る）
+void ledBlink(uint8_t blinks, uint16_t onMs, uint16_t offMs) {
+    LedCommand command = {blinks, false, onMs, offMs};
+    postLedCommand(command);
+}
+
+// スリープ前などにLEDパターンの再生完了を待つ
+void waitForLedIdle() {
+    while (ledQueue != NULL && (ledTaskBusy || uxQueueMessagesWaiting(ledQueue) > 0)) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
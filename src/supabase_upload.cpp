@@ -0,0 +1,842 @@
+#include "supabase_upload.h"
+#include <WiFi.h>
+#include "esp_timer.h"
+#include "mbedtls/base64.h"
+#include "time.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+#include "camera_capture.h"
+#include "time_sync.h"
+#include "offline_queue.h"
+
+// アップロード接続設定（keep-alive で撮影間のTLSハンドシェイクを省略）
+// 接続を閉じた後（定時撮影・Deep sleep復帰）は、保存したTLSセッションで再開してハンドシェイクを短縮
+const unsigned long UPLOAD_KEEPALIVE_IDLE = 60000; // 60秒以上未使用の接続は張り直す
+const unsigned long UPLOAD_RETRY_DELAY = 2000;      // 接続失敗時の最初の待機（失敗ごとに倍々＋ジッター）
+const unsigned long UPLOAD_RETRY_MAX_DELAY = 30000;
+
+SessionTlsClient uploadClient;
+bool uploadClientOpen = false;
+unsigned long uploadClientLastUsed = 0;
+unsigned int uploadClientRequests = 0;
+
+// サーバーからの送信停止指示（429/503、Deep sleepをまたいで保持）
+RTC_DATA_ATTR time_t serverBackoffUntilEpoch = 0;
+RTC_DATA_ATTR uint8_t serverBusyCount = 0;  // 連続した429/503の回数（成功で0に戻す）
+
+// ソケットから読み込んだがまだ解析していないバイト（パイプライン時は次のレスポンスの先頭）
+uint8_t responseBuffer[512];
+size_t responseBufferStart = 0;
+size_t responseBufferEnd = 0;
+
+// アップロード要求の組み立て用バッファ（ホスト・パス・認証ヘッダーは起動時に確定）
+char supabaseHost[64];
+uint16_t supabasePort = 443;
+char uploadPathPrefix[96];
+char uploadFixedHeaders[640];
+char uploadRequestBuffer[1024];
+char photoNotifyBody[768];  // 通知の行データ（JSON配列、1行あたり約200バイト）
+
+int lastUploadStatusCode = 0; // 直近のアップロードのHTTPステータス（0 = 通信エラー）
+
+// Supabaseホストの解決済みIP（RTCメモリ保持、Deep sleep復帰時のDNS解決を省略）
+RTC_DATA_ATTR uint32_t cachedSupabaseIp = 0;
+
+// 429/503を受けたら指示された時間（なければ倍々に延ばした時間）だけ送信を止める
+void noteServerBusy(long retryAfterSec) {
+    if (serverBusyCount < 16) serverBusyCount++;
+    uint32_t waitSec;
+    if (retryAfterSec >= 0) {
+        // 指示どおりの時刻に全台が戻らないよう最大25%遅らせる
+        waitSec = retryAfterSec + esp_random() % (retryAfterSec / 4 + 1);
+    } else {
+        waitSec = backoffDelayMs(serverBusyCount - 1, SERVER_BACKOFF_DEFAULT_SEC * 1000UL,
+                                 SERVER_BACKOFF_MAX_SEC * 1000UL, esp_random()) / 1000;
+    }
+    waitSec = min(waitSec, (uint32_t)SERVER_BACKOFF_MAX_SEC);
+    time_t until = time(nullptr) + waitSec;
+    portENTER_CRITICAL(&stateMux);
+    serverBackoffUntilEpoch = until;
+    portEXIT_CRITICAL(&stateMux);
+    LOG_W("[UPLOAD] Server busy, pausing uploads for %lu s", (unsigned long)waitSec);
+}
+
+// サーバーの指示で送信を止めている間か
+bool isServerBackingOff() {
+    return serverBackoffUntilEpoch != 0 && time(nullptr) < serverBackoffUntilEpoch;
+}
+
+// アップロード要求の固定部分を起動時に一度だけ組み立てる（撮影ごとのヒープ確保をなくす）
+bool initUploadRequestTemplate() {
+    // ホスト名・ポートはコンパイル時に求めた値をコピーするだけ（接続先の文字列はNUL終端が必要）
+    static_assert(CONFIG.hostLength < sizeof(supabaseHost), "SUPABASE_URL host too long");
+    memcpy(supabaseHost, CONFIG.host, CONFIG.hostLength);
+    supabaseHost[CONFIG.hostLength] = '\0';
+    supabasePort = CONFIG.port;
+    
+#if BENCHMARK_MODE && defined(BENCH_HOST)
+    // ベンチマーク時はローカルのモックHTTPSサーバーに送信
+    strncpy(supabaseHost, BENCH_HOST, sizeof(supabaseHost) - 1);
+    supabaseHost[sizeof(supabaseHost) - 1] = '\0';
+    supabasePort = BENCH_PORT;
+    cachedSupabaseIp = 0;
+#endif
+    
+    int prefixLength = snprintf(uploadPathPrefix, sizeof(uploadPathPrefix),
+                                "/storage/v1/object/%s/", settings.bucket);
+    int headerLength = snprintf(uploadFixedHeaders, sizeof(uploadFixedHeaders),
+                                "Host: %s\r\n%s", supabaseHost, UPLOAD_STATIC_HEADERS);
+    if (prefixLength >= (int)sizeof(uploadPathPrefix) || headerLength >= (int)sizeof(uploadFixedHeaders)) {
+        LOG_E("[CONFIG] Upload header template too long");
+        return false;
+    }
+    return true;
+}
+
+// Supabase接続を開く（接続リトライ付き）
+bool openUploadConnection() {
+    closeUploadConnection();
+    
+    // チェーンはハンドシェイク中にルート証明書で検証し、ピンは接続後に確認（SUPABASE_SPKI_PINS）
+    // 接続タイムアウト設定
+    uploadClient.setTimeout(30000); // 30秒
+    
+    LOG_I("[UPLOAD] Connecting to host: %s", supabaseHost);
+    
+    // 接続リトライ機能
+    int connectionRetries = 3;
+    
+    for (int i = 0; i < connectionRetries; i++) {
+        LOG_I("[UPLOAD] Connection attempt %d/%d", i + 1, connectionRetries);
+        
+        // キャッシュ済みIPがあればDNS解決を省略（SNI用にホスト名は渡す）
+        IPAddress hostIp(cachedSupabaseIp);
+        if (cachedSupabaseIp == 0 && WiFi.hostByName(supabaseHost, hostIp) == 1) {
+            cachedSupabaseIp = (uint32_t)hostIp;
+        }
+        
+        int64_t tlsStart = esp_timer_get_time();
+        if (cachedSupabaseIp != 0 && uploadClient.connectWithSession(hostIp, supabasePort, supabaseHost)) {
+            if (!verifyServerPin()) {
+                // 中間者の可能性があるため再試行せず、IPキャッシュと保存したセッションも破棄
+                LOG_E("[TLS] Server certificate does not match pinned key!");
+                uploadClient.stop();
+                cachedSupabaseIp = 0;
+                tlsSessionLength = 0;
+                return false;
+            }
+            recordPhase(PHASE_TLS, tlsStart);
+            uploadClient.saveSession();
+            uploadClientOpen = true;
+            uploadClientRequests = 0;
+            uploadClientLastUsed = millis();
+            LOG_I("[UPLOAD] Connected to Supabase");
+            return true;
+        }
+        
+        LOG_W("[UPLOAD] Connection failed, attempt %d", i + 1);
+        // 接続失敗時はIPキャッシュと保存したセッションを破棄して次回は再解決・フルハンドシェイク
+        cachedSupabaseIp = 0;
+        tlsSessionLength = 0;
+        if (i < connectionRetries - 1) {
+            delay(backoffDelayMs(i, UPLOAD_RETRY_DELAY, UPLOAD_RETRY_MAX_DELAY, esp_random()));
+        }
+    }
+    
+    LOG_E("[UPLOAD] Failed to connect after all retries!");
+    return false;
+}
+
+// Supabase接続を閉じる
+void closeUploadConnection() {
+    if (uploadClientOpen) {
+        LOG_I("[UPLOAD] Closing connection after %u request(s)", uploadClientRequests);
+    }
+    uploadClient.stop();
+    uploadClientOpen = false;
+    responseBufferStart = 0;
+    responseBufferEnd = 0;
+}
+
+// 既存のkeep-alive接続を再利用、使えなければ新規接続
+// reused には既存接続を使った場合 true が入る
+bool ensureUploadConnection(bool& reused) {
+    reused = false;
+    
+    if (uploadClientOpen) {
+        if (millis() - uploadClientLastUsed > UPLOAD_KEEPALIVE_IDLE) {
+            LOG_I("[UPLOAD] Keep-alive connection idle too long, reconnecting");
+        } else if (!uploadClient.connected()) {
+            LOG_I("[UPLOAD] Keep-alive connection closed by server, reconnecting");
+        } else {
+            reused = true;
+            LOG_I("[UPLOAD] Reusing keep-alive connection");
+            return true;
+        }
+    }
+    
+    return openUploadConnection();
+}
+
+// ソケットにデータが届くまで待機し、届けば true
+// 待機中はタスクを休ませ（busy-waitしない）、モデムスリープで無線も休止させる
+bool waitForUploadData(unsigned long timeoutMs) {
+    if (uploadClient.available() > 0) {
+        return true;
+    }
+    
+#if UPLOAD_WAIT_MODEM_SLEEP
+    WiFi.setSleep(true);
+#endif
+    bool received = false;
+    unsigned long waitStart = millis();
+    while (millis() - waitStart < timeoutMs) {
+        if (uploadClient.available() > 0) {
+            received = true;
+            break;
+        }
+        if (!uploadClient.connected()) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+#if UPLOAD_WAIT_MODEM_SLEEP
+    WiFi.setSleep(false);
+#endif
+    return received;
+}
+
+// HTTPレスポンスを読み取りステータスコードを返す（0 = 通信エラー）
+// keep-alive を維持できるようレスポンスボディまで固定バッファで読み捨てる
+// エラーステータスはヘッダー解析の時点で確定し、ボディは読み切らずに接続を閉じる
+// capture を渡した場合はボディ（収まる分）とETagを格納する
+int readUploadResponse(ResponseCapture* capture, bool headRequest) {
+    HttpResponseParser parser;
+    resetResponseParser(parser, capture, headRequest);
+    unsigned long timeoutMs = 15000; // 最初の応答は15秒まで待つ
+    
+    while (parser.state != HttpResponseParser::DONE && parser.state != HttpResponseParser::FAILED) {
+        if (responseBufferStart == responseBufferEnd) {
+            responseBufferStart = 0;
+            responseBufferEnd = 0;
+            if (!waitForUploadData(timeoutMs)) {
+                if (!uploadClient.connected()) {
+                    LOG_E("[UPLOAD] Connection closed before response!");
+                } else {
+                    LOG_E("[UPLOAD] Response timeout!");
+                }
+                closeUploadConnection();
+                return 0;
+            }
+            // 先読みしすぎないよう、ボディ中は残りバイト数までに制限
+            size_t readSize = sizeof(responseBuffer);
+            if (parser.state == HttpResponseParser::BODY) {
+                readSize = min(readSize, (size_t)parser.bodyRemaining);
+            }
+            int n = uploadClient.read(responseBuffer, readSize);
+            if (n <= 0) {
+                continue;
+            }
+            responseBufferEnd = n;
+            timeoutMs = 5000; // 応答の続きは5秒以内に届くはず
+        }
+        
+        responseBufferStart += feedResponseParser(parser, responseBuffer + responseBufferStart,
+                                                  responseBufferEnd - responseBufferStart);
+        
+        // エラー応答は既に受信済みの範囲だけログに出して打ち切る
+        if (parser.state == HttpResponseParser::BODY && parser.statusCode >= 300 &&
+            responseBufferStart == responseBufferEnd) {
+            break;
+        }
+    }
+    
+    if (parser.date[0] != '\0') {
+        syncTimeFromHttpDate(parser.date);
+    }
+    if (parser.state == HttpResponseParser::FAILED || parser.statusCode == 0) {
+        LOG_E("[UPLOAD] Invalid HTTP response!");
+        closeUploadConnection();
+        return 0;
+    }
+    LOG_I("[UPLOAD] HTTP Response: %d", parser.statusCode);
+    
+    bool success = (parser.statusCode == 200 || parser.statusCode == 201 ||
+                    parser.statusCode == 204 || parser.statusCode == 304);
+    if (!success) {
+        parser.errorBody[parser.errorBodyLength] = '\0';
+        LOG_E("[UPLOAD] Error response body: %s", parser.errorBody);
+        parser.keepAlive = false;
+    }
+    if (parser.statusCode == 429 || parser.statusCode == 503) {
+        noteServerBusy(parser.retryAfterSec);
+    } else if (success) {
+        serverBusyCount = 0;
+    }
+    
+    if (parser.keepAlive) {
+        uploadClientLastUsed = millis();
+    } else {
+        closeUploadConnection();
+    }
+    
+    return parser.statusCode;
+}
+
+// リクエストボディをストリーミング送信し、送信できたバイト数を返す
+// バッファはコピーせずTLS層へ渡す（カメラのフレームバッファをそのまま送信可能）
+// mbedTLSはレコードサイズ以下しか一度に受け付けないため部分書き込みは続きから再送し、
+// ソケットが書き込み可能になるまでの待機はTLS層（WANT_WRITE）に任せる
+size_t sendUploadBody(const uint8_t* data, size_t len) {
+    size_t totalSent = 0;
+    
+    while (totalSent < len) {
+        size_t segmentSize = min((size_t)settings.uploadChunkSize, len - totalSent);
+        size_t bytesWritten = uploadClient.write(data + totalSent, segmentSize);
+        
+        if (bytesWritten == 0) {
+            LOG_E("[UPLOAD] Write error at byte %u/%u", (unsigned int)totalSent, (unsigned int)len);
+            return totalSent;
+        }
+        
+        totalSent += bytesWritten;
+        
+        // 進捗表示（10%ごと）
+        if ((totalSent * 10 / len) != ((totalSent - bytesWritten) * 10 / len)) {
+            LOG_D("[UPLOAD] Progress: %u%%", (unsigned int)(totalSent * 100 / len));
+        }
+    }
+    
+    return totalSent;
+}
+
+// アップロード要求ヘッダーを uploadRequestBuffer に組み立て、長さを返す（0 = 失敗）
+int buildUploadRequest(const char* filename, size_t imageSize, const char* extraHeaders) {
+    // 起動時に組み立てた固定部分にパスと長さだけ埋め込む
+    int requestLength = snprintf(uploadRequestBuffer, sizeof(uploadRequestBuffer),
+                                 "POST %s%s HTTP/1.1\r\n%s%sContent-Length: %u\r\n\r\n",
+                                 uploadPathPrefix, filename, uploadFixedHeaders, extraHeaders,
+                                 (unsigned int)imageSize);
+    if (requestLength <= 0 || requestLength >= (int)sizeof(uploadRequestBuffer)) {
+        LOG_E("[UPLOAD] Request header too long!");
+        return 0;
+    }
+    return requestLength;
+}
+
+// 1件分のリクエスト（ヘッダー＋ボディ）を送信
+bool sendUploadRequest(const UploadItem& item, const char* extraHeaders) {
+    LOG_I("[UPLOAD] Uploading %u bytes to Supabase as %s", (unsigned int)item.size, item.filename);
+    
+    int requestLength = buildUploadRequest(item.filename, item.size, extraHeaders);
+    if (requestLength == 0) {
+        return false;
+    }
+    
+    int64_t sendStart = esp_timer_get_time();
+    
+    // ヘッダー送信
+    if (uploadClient.write((const uint8_t*)uploadRequestBuffer, requestLength) != (size_t)requestLength) {
+        LOG_E("[UPLOAD] Header write error");
+        return false;
+    }
+    
+    // 画像データをフレームバッファから直接ストリーミング送信
+    if (sendUploadBody(item.data, item.size) != item.size) {
+        return false;
+    }
+    
+    recordPhase(PHASE_SEND, sendStart);
+    
+    // 送信スループットを記録（小さいフレームはTCPバッファで見かけ上速くなるため除外）
+    int64_t sendUs = esp_timer_get_time() - sendStart;
+    if (item.size >= settings.uploadChunkSize && sendUs > 0) {
+        uint32_t bps = (uint32_t)((uint64_t)item.size * 1000000 / sendUs);
+        portENTER_CRITICAL(&stateMux);
+        encoderState.throughputBps = encoderState.throughputBps == 0
+                                         ? bps
+                                         : (encoderState.throughputBps * 3 + bps) / 4;
+        portEXIT_CRITICAL(&stateMux);
+    }
+    return true;
+}
+
+// 前回の送信以降のログを写真と同じ名前で logs/ にアップロード（keep-alive接続を再利用）
+bool uploadLogTail(const char* photoFilename) {
+    if (logTailBuffer == nullptr || !uploadClient.connected()) {
+        return false;
+    }
+    uint32_t endIndex = 0;
+    size_t length = formatLogTail(logTailBuffer, LOG_TAIL_BUFFER_SIZE, endIndex);
+    if (length == 0) {
+        return false;
+    }
+    
+    // サムネイルの thumbs/ などのディレクトリと拡張子を除いた名前を使う
+    const char* name = strrchr(photoFilename, '/');
+    name = name != nullptr ? name + 1 : photoFilename;
+    int nameLength = strcspn(name, ".");
+    int requestLength = snprintf(uploadRequestBuffer, sizeof(uploadRequestBuffer),
+                                 "POST %slogs/%.*s.log HTTP/1.1\r\n"
+                                 "Host: %s\r\n"
+                                 "%s"
+                                 "Content-Type: text/plain; charset=utf-8\r\n"
+                                 "x-upsert: true\r\n"
+                                 "Connection: keep-alive\r\n"
+                                 "Content-Length: %u\r\n\r\n",
+                                 uploadPathPrefix, nameLength, name, supabaseHost, SUPABASE_AUTH_HEADER,
+                                 (unsigned int)length);
+    if (requestLength <= 0 || requestLength >= (int)sizeof(uploadRequestBuffer)) {
+        LOG_E("[LOG] Log upload request header too long!");
+        return false;
+    }
+    if (uploadClient.write((const uint8_t*)uploadRequestBuffer, requestLength) != (size_t)requestLength ||
+        sendUploadBody((const uint8_t*)logTailBuffer, length) != length) {
+        closeUploadConnection();
+        return false;
+    }
+    
+    int statusCode = readUploadResponse();
+    if (statusCode != 0) {
+        uploadClientRequests++;
+    }
+    if (statusCode != 200 && statusCode != 201) {
+        LOG_W("[LOG] Log tail upload failed, status %d", statusCode);
+        return false;
+    }
+    logRing.tailIndex = endIndex;
+    logRing.tailPending = false;
+    LOG_I("[LOG] Uploaded %u bytes of log tail", (unsigned int)length);
+    return true;
+}
+
+// アップロード成功分の行データを photoNotifyBody にJSON配列で出力し、長さを返す（0 = 対象なし）
+int formatPhotoNotifyBody(const UploadItem* items, int count) {
+    char uploadedAt[24] = "";
+    if (isTimeValid()) {
+        time_t now = time(nullptr);
+        struct tm utc;
+        gmtime_r(&now, &utc);
+        strftime(uploadedAt, sizeof(uploadedAt), "%Y-%m-%dT%H:%M:%SZ", &utc);
+    }
+    char timingSummary[128];
+    formatPhaseSummary(timingSummary, sizeof(timingSummary));
+    
+    int used = 0;
+    int rows = 0;
+    for (int i = 0; i < count; i++) {
+        if (items[i].statusCode != 200 && items[i].statusCode != 201) continue;
+        // ファイル名・処理時間は英数字と記号のみなのでエスケープ不要
+        int n = snprintf(photoNotifyBody + used, sizeof(photoNotifyBody) - used,
+                         "%c{\"path\":\"%s\",\"size\":%u,\"uploaded_at\":%s%s%s,\"timing\":\"%s\"}",
+                         rows == 0 ? '[' : ',', items[i].filename, (unsigned int)items[i].size,
+                         uploadedAt[0] != '\0' ? "\"" : "", uploadedAt[0] != '\0' ? uploadedAt : "null",
+                         uploadedAt[0] != '\0' ? "\"" : "", timingSummary);
+        // 末尾の "]" の分を残して収まらない行は送らない
+        if (n <= 0 || used + n + 1 >= (int)sizeof(photoNotifyBody)) {
+            LOG_W("[NOTIFY] Notification body full, %d row(s) not sent", count - i);
+            break;
+        }
+        used += n;
+        rows++;
+    }
+    if (rows == 0) {
+        return 0;
+    }
+    photoNotifyBody[used++] = ']';
+    photoNotifyBody[used] = '\0';
+    return used;
+}
+
+// アップロード成功分をREST APIのテーブルに追加（keep-alive接続を再利用し、ハンドシェイクなし）
+bool notifyUploadedPhotos(const UploadItem* items, int count) {
+    if (!uploadClientOpen || !uploadClient.connected()) {
+        LOG_W("[NOTIFY] Upload connection closed, notification skipped");
+        return false;
+    }
+    int length = formatPhotoNotifyBody(items, count);
+    if (length == 0) {
+        return false;
+    }
+    
+    int requestLength = snprintf(uploadRequestBuffer, sizeof(uploadRequestBuffer),
+                                 "POST /rest/v1/" PHOTO_NOTIFY_TABLE " HTTP/1.1\r\n"
+                                 "Host: %s\r\n"
+                                 "%s"
+                                 "apikey: " SUPABASE_SERVICE_KEY "\r\n"
+                                 "Content-Type: application/json\r\n"
+                                 "Prefer: return=minimal\r\n"
+                                 "Connection: keep-alive\r\n"
+                                 "Content-Length: %d\r\n\r\n",
+                                 supabaseHost, SUPABASE_AUTH_HEADER, length);
+    if (requestLength <= 0 || requestLength >= (int)sizeof(uploadRequestBuffer)) {
+        LOG_E("[NOTIFY] Notification request header too long!");
+        return false;
+    }
+    
+    int64_t sendStart = esp_timer_get_time();
+    if (uploadClient.write((const uint8_t*)uploadRequestBuffer, requestLength) != (size_t)requestLength ||
+        sendUploadBody((const uint8_t*)photoNotifyBody, length) != (size_t)length) {
+        closeUploadConnection();
+        return false;
+    }
+    
+    int statusCode = readUploadResponse();
+    if (statusCode != 0) {
+        uploadClientRequests++;
+    }
+    if (statusCode != 200 && statusCode != 201 && statusCode != 204) {
+        LOG_W("[NOTIFY] Notification insert failed, status %d", statusCode);
+        return false;
+    }
+    LOG_I("[NOTIFY] Registered upload metadata in %lu ms",
+          (unsigned long)((esp_timer_get_time() - sendStart) / 1000));
+    return true;
+}
+
+// 再開可能アップロードで送るフレームか
+bool isResumableItem(const UploadItem& item) {
+    return RESUMABLE_UPLOAD && item.resume != nullptr && item.size >= RESUMABLE_UPLOAD_MIN_SIZE;
+}
+
+// 再開可能アップロード用のリクエストを1件送って応答を読む（0 = 通信エラー）
+int sendResumableRequest(const char* method, const char* path, const char* headers,
+                         const uint8_t* body, size_t bodyLength, ResponseCapture& capture) {
+    int requestLength = snprintf(uploadRequestBuffer, sizeof(uploadRequestBuffer),
+                                 "%s %s HTTP/1.1\r\n"
+                                 "Host: %s\r\n"
+                                 "%s"
+                                 "Tus-Resumable: 1.0.0\r\n"
+                                 "%s"
+                                 "Content-Length: %u\r\n"
+                                 "Connection: keep-alive\r\n\r\n",
+                                 method, path, supabaseHost, SUPABASE_AUTH_HEADER, headers,
+                                 (unsigned int)bodyLength);
+    if (requestLength <= 0 || requestLength >= (int)sizeof(uploadRequestBuffer)) {
+        LOG_E("[UPLOAD] Request header too long!");
+        return 0;
+    }
+    if (uploadClient.write((const uint8_t*)uploadRequestBuffer, requestLength) != (size_t)requestLength) {
+        LOG_E("[UPLOAD] Header write error");
+        closeUploadConnection();
+        return 0;
+    }
+    if (bodyLength > 0 && sendUploadBody(body, bodyLength) != bodyLength) {
+        closeUploadConnection();
+        return 0;
+    }
+    
+    int statusCode = readUploadResponse(&capture, strcmp(method, "HEAD") == 0);
+    if (statusCode != 0) {
+        uploadClientRequests++;
+    }
+    return statusCode;
+}
+
+// 1フレームを再開可能アップロード（tusプロトコル）で送信し、HTTPステータスを返す
+// PATCHごとにサーバーが受信確認したオフセットを記録し、接続が切れたら
+// HEADで受信済みバイト数を確認して続きから送る（最初からやり直さない）
+int uploadResumable(UploadItem& item) {
+    ResumableUpload& resume = *item.resume;
+    ResponseCapture capture = {nullptr, 0, 0, "", "", -1, false};
+    char headers[320];
+    bool offsetConfirmed = false;
+    bool restarted = false;   // 期限切れURLの作り直しは1回まで
+    bool recovered = false;   // オフセット不一致の確認し直しは1回まで
+    bool conflict = false;
+    
+    for (int attempt = 0; attempt < RESUMABLE_MAX_ATTEMPTS; attempt++) {
+        conflict = false;
+        bool reused = false;
+        if (!ensureUploadConnection(reused)) {
+            return 0;
+        }
+        
+        // アップロードURLを作成（バケット・オブジェクト名はBase64でメタデータに入れる）
+        if (resume.location[0] == '\0') {
+            unsigned char bucketB64[96];
+            unsigned char nameB64[72];
+            size_t bucketLength = 0;
+            size_t nameLength = 0;
+            mbedtls_base64_encode(bucketB64, sizeof(bucketB64), &bucketLength,
+                                  (const unsigned char*)settings.bucket, strlen(settings.bucket));
+            mbedtls_base64_encode(nameB64, sizeof(nameB64), &nameLength,
+                                  (const unsigned char*)item.filename, strlen(item.filename));
+            bucketB64[bucketLength] = '\0';
+            nameB64[nameLength] = '\0';
+            snprintf(headers, sizeof(headers),
+                     "Upload-Length: %u\r\n"
+                     "Upload-Metadata: bucketName %s,objectName %s,contentType aW1hZ2UvanBlZw==\r\n"
+                     "x-upsert: true\r\n",
+                     (unsigned int)item.size, bucketB64, nameB64);
+            
+            int statusCode = sendResumableRequest("POST", "/storage/v1/upload/resumable", headers,
+                                                  nullptr, 0, capture);
+            if (statusCode == 0) {
+                continue;
+            }
+            if (statusCode != 201 || capture.location[0] == '\0') {
+                LOG_E("[UPLOAD] Resumable upload not created, status: %d", statusCode);
+                return statusCode;
+            }
+            
+            // 完全なURLで返るためホスト部分を除いてパスだけ保持
+            const char* path = capture.location;
+            const char* scheme = strstr(path, "://");
+            if (scheme != nullptr) {
+                path = strchr(scheme + 3, '/');
+                if (path == nullptr) {
+                    return 0;
+                }
+            }
+            strncpy(resume.location, path, sizeof(resume.location) - 1);
+            resume.location[sizeof(resume.location) - 1] = '\0';
+            resume.offset = 0;
+            offsetConfirmed = true;
+            saveResumableState(resume);
+            LOG_I("[UPLOAD] Resumable upload created: %s", resume.location);
+        }
+        
+        // 以前の続きの場合はサーバーの受信済みバイト数を確認
+        if (!offsetConfirmed) {
+            int statusCode = sendResumableRequest("HEAD", resume.location, "", nullptr, 0, capture);
+            if (statusCode == 0) {
+                continue;
+            }
+            if ((statusCode == 404 || statusCode == 410) && !restarted) {
+                // 期限切れのアップロードURLは作り直す
+                LOG_W("[UPLOAD] Resumable upload expired, starting over");
+                resume.location[0] = '\0';
+                resume.offset = 0;
+                restarted = true;
+                attempt--;
+                continue;
+            }
+            if (statusCode != 200 && statusCode != 204) {
+                return statusCode;
+            }
+            if (capture.uploadOffset < 0 || capture.uploadOffset > (long)item.size) {
+                return 0;
+            }
+            resume.offset = capture.uploadOffset;
+            offsetConfirmed = true;
+            LOG_I("[UPLOAD] Resuming upload at byte %lu/%u", (unsigned long)resume.offset, (unsigned int)item.size);
+        }
+        
+        // 残りを RESUMABLE_CHUNK_SIZE ごとにPATCHで送信
+        while (resume.offset < item.size) {
+            size_t chunk = min((size_t)RESUMABLE_CHUNK_SIZE, item.size - resume.offset);
+            snprintf(headers, sizeof(headers),
+                     "Upload-Offset: %lu\r\n"
+                     "Content-Type: application/offset+octet-stream\r\n",
+                     (unsigned long)resume.offset);
+            
+            int64_t sendStart = esp_timer_get_time();
+            int statusCode = sendResumableRequest("PATCH", resume.location, headers,
+                                                  item.data + resume.offset, chunk, capture);
+            if (statusCode == 0) {
+                // 途中まで届いている可能性があるため次の接続でオフセットを確認
+                offsetConfirmed = false;
+                break;
+            }
+            if (statusCode == 409) {
+                // オフセット不一致は受信済みバイト数を確認し直す
+                offsetConfirmed = false;
+                conflict = true;
+                break;
+            }
+            if (statusCode != 204 || capture.uploadOffset <= (long)resume.offset) {
+                LOG_E("[UPLOAD] Resumable chunk rejected, status: %d", statusCode);
+                return statusCode == 204 ? 0 : statusCode;
+            }
+            recordPhase(PHASE_SEND, sendStart);
+            resume.offset = capture.uploadOffset;
+            saveResumableState(resume);
+        }
+        
+        if (resume.offset >= item.size) {
+            LOG_I("[UPLOAD] Resumable upload complete");
+            resume.location[0] = '\0';
+            return 201; // オブジェクト作成完了（通常のPOSTと同じ扱い）
+        }
+        // 409 はエラー応答として接続が閉じられるため、次の試行で接続し直して確認する
+        // 通信エラーではないので試行回数には数えない（1回まで）
+        if (conflict && !recovered) {
+            recovered = true;
+            attempt--;
+        }
+    }
+    
+    LOG_W("[UPLOAD] Resumable upload interrupted at byte %lu/%u", (unsigned long)resume.offset, (unsigned int)item.size);
+    return 0;
+}
+
+// 複数フレームを1本のkeep-alive接続でまとめて送信（HTTP/1.1パイプライン）
+// 最大 UPLOAD_PIPELINE_DEPTH 件を応答待ちなしで送り、応答は送信順に読み取る
+// 各 item.statusCode に結果（0 = 未送信・通信エラー）が入り、成功件数を返す
+int uploadBatchToSupabase(UploadItem* items, int count) {
+    for (int i = 0; i < count; i++) {
+        items[i].statusCode = 0;
+    }
+    
+    if (WiFi.status() != WL_CONNECTED) {
+        LOG_E("[UPLOAD] WiFi not connected!");
+        closeUploadConnection();
+        return 0;
+    }
+    
+    if (supabaseHost[0] == '\0') {
+        LOG_E("[UPLOAD] Upload request template not initialized!");
+        return 0;
+    }
+    
+    // 直近の処理時間と電池の状態をヘッダーに添付（フリート全体の電池寿命チューニング用）
+    char timingHeader[256] = "";
+    size_t timingUsed = 0;
+#if SHOT_TIMING_HEADER
+    char timingSummary[128];
+    formatPhaseSummary(timingSummary, sizeof(timingSummary));
+    if (timingSummary[0] != '\0') {
+        timingUsed += snprintf(timingHeader, sizeof(timingHeader), "X-Shot-Timing: %s\r\n", timingSummary);
+    }
+#endif
+#if POWER_TELEMETRY_HEADER
+    char powerSummary[64];
+    formatPowerSummary(powerSummary, sizeof(powerSummary));
+    if (powerSummary[0] != '\0' && timingUsed < sizeof(timingHeader)) {
+        snprintf(timingHeader + timingUsed, sizeof(timingHeader) - timingUsed, "X-Power: %s\r\n", powerSummary);
+    }
+#endif
+    
+    int next = 0; // 応答を受け取っていない最初の項目
+    bool retried = false;
+    
+    while (next < count) {
+        // サーバーから待機を指示されている間は送らない（未送信分はオフラインキューで後から再送）
+        if (isServerBackingOff()) {
+            LOG_W("[UPLOAD] Server backoff active for %lu s, not sending",
+                  (unsigned long)(serverBackoffUntilEpoch - time(nullptr)));
+            break;
+        }
+        bool reused = false;
+        if (!ensureUploadConnection(reused)) {
+            break;
+        }
+        
+        int sent = next;
+        int answered = next;
+        bool connectionFailed = false;
+        
+        while (answered < count && !connectionFailed) {
+            // 応答待ちが上限に達するまで先行送信（再開可能アップロードの手前で止める）
+            while (sent < count && sent - answered < UPLOAD_PIPELINE_DEPTH && !isResumableItem(items[sent])) {
+                if (!sendUploadRequest(items[sent], timingHeader)) {
+                    connectionFailed = true;
+                    break;
+                }
+                sent++;
+            }
+            if (answered == sent) {
+                if (sent == count || connectionFailed) {
+                    break;
+                }
+                // 大きいフレームはパイプラインが空になってから単独で送信
+                int statusCode = uploadResumable(items[sent]);
+                if (statusCode == 0) {
+                    connectionFailed = true;
+                    break;
+                }
+                items[sent].statusCode = statusCode;
+                sent++;
+                answered++;
+                if (!uploadClientOpen && answered < count) {
+                    connectionFailed = true;
+                }
+                continue;
+            }
+            
+            // HTTPステータスコード確認
+            int64_t responseStart = esp_timer_get_time();
+            int statusCode = readUploadResponse();
+            if (statusCode == 0) {
+                connectionFailed = true;
+                break;
+            }
+            recordPhase(PHASE_RESPONSE, responseStart);
+            uploadClientRequests++;
+            items[answered].statusCode = statusCode;
+            answered++;
+            
+            // サーバーが接続を閉じた場合、送信済みで応答のない分は新しい接続で再送
+            if (!uploadClientOpen && answered < count) {
+                connectionFailed = true;
+            }
+        }
+        
+        if (connectionFailed) {
+            closeUploadConnection();
+        }
+        
+        bool progressed = answered > next;
+        next = answered;
+        if (!connectionFailed) {
+            break;
+        }
+        
+        // 進展がない場合は、再利用した接続が切れていたときだけ1回再試行
+        if (!progressed) {
+            if (!reused || retried) {
+                break;
+            }
+            retried = true;
+            LOG_W("[UPLOAD] Stale keep-alive connection, retrying with new connection");
+        }
+    }
+    
+    int succeeded = 0;
+    for (int i = 0; i < count; i++) {
+        if (items[i].statusCode == 200 || items[i].statusCode == 201) {
+            succeeded++;
+        }
+    }
+    
+    if (count > 1) {
+        LOG_I("[UPLOAD] Batch result: %d/%d uploaded over %u request(s) on current connection", succeeded, count, uploadClientRequests);
+    }
+    
+#if PHOTO_NOTIFY
+    // 後段がStorageをポーリングしなくて済むよう、成功分のメタデータを同じ接続で登録
+    if (succeeded > 0) {
+        notifyUploadedPhotos(items, count);
+    }
+#endif
+    return succeeded;
+}
+
+// SupabaseストレージにアップロードするHTTPS関数（エラーハンドリング強化）
+bool uploadPhotoToSupabase(uint8_t* imageData, size_t imageSize, const char* filename) {
+    lastUploadStatusCode = 0;
+    
+    if (imageData == nullptr || imageSize == 0) {
+        LOG_E("[UPLOAD] Invalid image data!");
+        return false;
+    }
+    
+    ResumableUpload resume;
+    initResumableUpload(resume, 0);
+    UploadItem item = {imageData, imageSize, filename, 0, &resume};
+    bool success = uploadBatchToSupabase(&item, 1) == 1;
+    lastUploadStatusCode = item.statusCode;
+    
+    if (success) {
+        LOG_I("[UPLOAD] Successfully uploaded: %s", filename);
+    } else if (item.statusCode != 0) {
+        LOG_E("[UPLOAD] Upload failed - check Supabase configuration");
+    } else {
+        LOG_E("[UPLOAD] Upload failed - connection error");
+    }
+    
+    return success;
+}
@@ -0,0 +1,127 @@
+#include "time_sync.h"
+#include "esp_timer.h"
+#include "esp_sntp.h"
+#include "time.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "supabase_upload.h"
+
+// NTPサーバー設定（config.hから読み込み）
+const char* ntpServer = NTP_SERVER;
+const long gmtOffset_sec = GMT_OFFSET_SEC;
+const int daylightOffset_sec = DAYLIGHT_OFFSET_SEC;
+
+// 時刻管理（Deep sleep中もRTCで進む。アップロード応答のDateヘッダーで補正し、SNTPは必要な時のみ）
+const time_t TIME_VALID_EPOCH = 1700000000;   // これより前の時刻は未設定とみなす（2023年11月）
+const time_t TIME_DATE_MAX_DRIFT_SEC = 2;     // Dateヘッダーとのずれがこれを超えたら補正（秒単位の精度のため）
+RTC_DATA_ATTR time_t lastTimeSyncEpoch = 0;   // 最後に時刻を合わせた時刻（0 = 未同期）
+std::atomic<bool> sntpSyncDone(false);        // SNTP同期完了（メインループで停止する）
+time_t sntpStartEpoch = 0;                    // SNTP開始時の時刻（補正量の計算用）
+int64_t sntpStartUs = 0;
+
+// タイムスタンプ生成関数（呼び出し側のバッファに書き込み）
+void getFormattedTimestamp(char* out, size_t outSize) {
+    if (!isTimeValid()) {
+        LOG_I("[TIME] Time not set yet");
+        // 時刻未設定時は起動回数と稼働時間で順序を保つ（Deep sleepをまたいでも単調増加）
+        snprintf(out, outSize, "nosync_%05lu_%010lu", (unsigned long)rtcState.bootCount, millis());
+        return;
+    }
+    
+    struct tm timeinfo;
+    time_t now = time(nullptr);
+    localtime_r(&now, &timeinfo);
+    strftime(out, outSize, "%Y%m%d_%H%M%S", &timeinfo);
+}
+
+// システム時刻が設定済みか（電源投入直後は1970年から始まる）
+bool isTimeValid() {
+    return time(nullptr) >= TIME_VALID_EPOCH;
+}
+
+// タイムゾーンを設定（環境変数はDeep sleepで消えるため毎回起動時に設定）
+void applyTimeZone() {
+    // POSIX形式は符号が逆（JST = UTC+9 は "UTC-9"）
+    long offset = -gmtOffset_sec;
+    char tz[40];
+    int length = snprintf(tz, sizeof(tz), "UTC%ld:%02ld", offset / 3600, labs(offset % 3600) / 60);
+    if (daylightOffset_sec != 0) {
+        long dstOffset = offset - daylightOffset_sec;
+        snprintf(tz + length, sizeof(tz) - length, "DST%ld:%02ld", dstOffset / 3600, labs(dstOffset % 3600) / 60);
+    }
+    setenv("TZ", tz, 1);
+    tzset();
+}
+
+// 時刻が飛んだ分だけRTCに保持している予定時刻をずらす（撮影スケジュールの位相を保つ）
+// SNTPのコールバック（lwIPのタスク）とアップロードタスクから呼ばれ、loop()の書き込みと競合するため stateMux 内で行う
+void applyTimeStep(time_t delta) {
+    portENTER_CRITICAL(&stateMux);
+    if (rtcState.nextShotEpoch != 0) rtcState.nextShotEpoch += delta;
+    if (rtcState.lastPhotoEpoch != 0) rtcState.lastPhotoEpoch += delta;
+    if (lastConfigCheckEpoch != 0) lastConfigCheckEpoch += delta;
+    if (serverBackoffUntilEpoch != 0) serverBackoffUntilEpoch += delta;
+    portEXIT_CRITICAL(&stateMux);
+}
+
+// HTTPのDateヘッダー（例: "Tue, 14 Oct 2025 03:04:05 GMT"）で時刻を補正
+// アップロードのたびに届くため、SNTPを使わずに時刻を維持できる
+void syncTimeFromHttpDate(const char* value) {
+    time_t serverEpoch;
+    if (!parseHttpDate(value, serverEpoch) || serverEpoch < TIME_VALID_EPOCH) {
+        return;
+    }
+    
+    time_t now = time(nullptr);
+    time_t drift = now - serverEpoch;
+    if (drift >= -TIME_DATE_MAX_DRIFT_SEC && drift <= TIME_DATE_MAX_DRIFT_SEC) {
+        lastTimeSyncEpoch = now;
+        return;
+    }
+    
+    // Dateは秒単位で切り捨てのため0.5秒進めて設定
+    struct timeval tv = {serverEpoch, 500000};
+    settimeofday(&tv, nullptr);
+    applyTimeStep(serverEpoch - now);
+    lastTimeSyncEpoch = serverEpoch;
+    LOG_I("[TIME] Clock set from HTTP Date header, drift: %ld s", (long)drift);
+}
+
+// SNTP同期完了時（lwIPのタスクから呼ばれる）
+void sntpSyncCallback(struct timeval* tv) {
+    // 開始時点からの経過時間で、同期前の時計が示していたはずの時刻を求める
+    time_t expected = sntpStartEpoch + (time_t)((esp_timer_get_time() - sntpStartUs) / 1000000);
+    applyTimeStep(tv->tv_sec - expected);
+    lastTimeSyncEpoch = tv->tv_sec;
+    sntpSyncDone = true;
+    notifyMainLoop();
+}
+
+// 時刻未設定、またはDateヘッダーでの補正が長期間ない場合のみSNTPを裏で開始（待たない）
+void maybeStartSntp() {
+    if (sntp_enabled()) {
+        return;
+    }
+    if (isTimeValid() && lastTimeSyncEpoch != 0 && time(nullptr) - lastTimeSyncEpoch < TIME_SNTP_RESYNC_SEC) {
+        return;
+    }
+    LOG_I("[TIME] Starting background SNTP sync");
+    sntpStartEpoch = time(nullptr);
+    sntpStartUs = esp_timer_get_time();
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, (char*)ntpServer);
+    sntp_set_time_sync_notification_cb(sntpSyncCallback);
+    sntp_init();
+}
+
+// SNTPを停止（同期後は定期ポーリングの通信をしない）
+void stopSntp() {
+    if (sntp_enabled()) {
+        sntp_stop();
+    }
+    char timestamp[32];
+    getFormattedTimestamp(timestamp, sizeof(timestamp));
+    LOG_I("[TIME] Time synchronized by SNTP: %s", timestamp);
+}
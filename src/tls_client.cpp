@@ -0,0 +1,234 @@
+#include "tls_client.h"
+#include <WiFi.h>
+#include "mbedtls/sha256.h"
+#include "mbedtls/net_sockets.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "root_ca.h"
+#include "app_config.h"
+#include "app_log.h"
+#include "time_sync.h"
+#include "supabase_upload.h"
+
+// TLSのハードウェアアクセラレーションとレコードバッファの大きさは、フレームワークの事前ビルド済みmbedTLS（sdkconfig）で決まる
+// platformio.ini の -D では変えられないため、アクセラレーションが無効なSDKでビルドした場合は警告する
+#if !defined(CONFIG_MBEDTLS_HARDWARE_AES) || !defined(CONFIG_MBEDTLS_HARDWARE_SHA) || !defined(CONFIG_MBEDTLS_HARDWARE_MPI)
+#warning "mbedTLS hardware acceleration (AES/SHA/MPI) is disabled in the framework sdkconfig"
+#endif
+
+// 証明書ピンニング（チェーン検証に加えてリーフの公開鍵を固定、接続ごとにハッシュ1回）
+const int SPKI_PIN_MAX = 3;
+uint8_t spkiPins[SPKI_PIN_MAX][32];
+int spkiPinCount = 0;
+
+// チェーン検証用のルート証明書（初回接続時に1回だけ解析し、以降の接続で使い回す）
+mbedtls_x509_crt rootCaChain;
+bool rootCaLoaded = false;
+
+// 直近のTLSセッション（mbedtls_ssl_session_save の形式、RTCメモリ保持）
+// サーバー証明書を含むため約2KBを確保し、収まらない場合は保存しない
+const size_t TLS_SESSION_BLOB_SIZE = 2048;
+RTC_DATA_ATTR uint8_t tlsSessionBlob[TLS_SESSION_BLOB_SIZE];
+RTC_DATA_ATTR size_t tlsSessionLength = 0;  // 0 = 保存なし
+
+// SUPABASE_SPKI_PINS（16進のSHA-256、カンマ区切り）を解析（起動時に1回）
+bool initCertificatePins() {
+    spkiPinCount = parseSpkiPins(SUPABASE_SPKI_PINS, spkiPins, SPKI_PIN_MAX);
+    if (spkiPinCount < 0) {
+        LOG_E("[TLS] Invalid SUPABASE_SPKI_PINS entry, pinning disabled");
+        spkiPinCount = 0;
+        return false;
+    }
+    
+    if (spkiPinCount == 0) {
+        LOG_I("[TLS] Certificate pinning disabled (SUPABASE_SPKI_PINS not set)");
+    } else {
+        LOG_I("[TLS] Certificate pins loaded: %d", spkiPinCount);
+    }
+    return spkiPinCount > 0;
+}
+
+// ルート証明書を解析（初回のみ、解析済みのチェーンは接続をまたいで保持）
+bool loadRootCaChain() {
+    if (rootCaLoaded) {
+        return true;
+    }
+    mbedtls_x509_crt_init(&rootCaChain);
+    int ret = mbedtls_x509_crt_parse(&rootCaChain, (const unsigned char*)TLS_ROOT_CA_PEM, sizeof(TLS_ROOT_CA_PEM));
+    if (ret < 0) {
+        LOG_E("[TLS] Root CA parse failed: -0x%04x", (unsigned int)-ret);
+        mbedtls_x509_crt_free(&rootCaChain);
+        return false;
+    }
+    if (ret > 0) {
+        LOG_W("[TLS] %d root CA certificate(s) skipped", ret);
+    }
+    rootCaLoaded = true;
+    LOG_I("[TLS] Root CAs loaded, free heap: %lu", (unsigned long)ESP.getFreeHeap());
+    return true;
+}
+
+// 証明書の検証結果を補正（時刻未設定の間だけ有効期限の判定を外す）
+// 時刻はアップロード応答のDateヘッダーで合わせるため、電源投入直後にSNTPが失敗しても接続できるようにする
+int tlsVerifyCallback(void* context, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+    if (!isTimeValid()) {
+        *flags &= ~(MBEDTLS_X509_BADCERT_EXPIRED | MBEDTLS_X509_BADCERT_FUTURE);
+    }
+    return 0;
+}
+
+// サーバー証明書（リーフ）の公開鍵がピンに一致するか（チェーン検証に加えて接続先の鍵を固定）
+// 秘密鍵の所持がハンドシェイクで証明されるリーフの鍵だけを照合する
+// （中間CAの証明書は公開されており、偽のリーフと一緒に送られると一致してしまう）
+bool verifyServerPin() {
+    if (spkiPinCount == 0) {
+        return true;
+    }
+#if BENCHMARK_MODE && defined(BENCH_HOST)
+    return true; // モックサーバーの自己署名証明書は対象外
+#else
+    const mbedtls_x509_crt* leaf = uploadClient.getPeerCertificate();
+    uint8_t hash[32];
+    if (leaf == nullptr || mbedtls_sha256_ret(leaf->pk_raw.p, leaf->pk_raw.len, hash, 0) != 0) {
+        return false;
+    }
+    for (int i = 0; i < spkiPinCount; i++) {
+        if (memcmp(hash, spkiPins[i], sizeof(hash)) == 0) {
+            return true;
+        }
+    }
+    return false;
+#endif
+}
+
+// ソケット接続とTLSハンドシェイク（保存したセッションがあれば再開を申し出る）
+// サーバーが再開を断った場合は通常のフルハンドシェイクになる
+// 呼び出し前に stop() で前の接続を閉じておくこと（closeUploadConnection）
+int SessionTlsClient::connectWithSession(IPAddress ip, uint16_t port, const char* host) {
+    mbedtls_ssl_init(&sslclient->ssl_ctx);
+    mbedtls_ssl_config_init(&sslclient->ssl_conf);
+    mbedtls_ctr_drbg_init(&sslclient->drbg_ctx);
+    mbedtls_entropy_init(&sslclient->entropy_ctx);
+    mbedtls_x509_crt_init(&sslclient->ca_cert);  // stop() が解放する側（ルート証明書はここに入れない）
+    sslclient->handshake_timeout = _timeout > 0 ? _timeout : 120000;
+    
+    sslclient->socket = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sslclient->socket < 0) {
+        LOG_E("[TLS] Socket allocation failed");
+        return 0;
+    }
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = (uint32_t)ip;
+    serverAddr.sin_port = htons(port);
+    
+    // 非ブロッキングで接続してタイムアウトを効かせ、接続後はブロッキング＋送受信タイムアウトに戻す
+    fcntl(sslclient->socket, F_SETFL, fcntl(sslclient->socket, F_GETFL, 0) | O_NONBLOCK);
+    int res = lwip_connect(sslclient->socket, (struct sockaddr*)&serverAddr, sizeof(serverAddr));
+    if (res < 0 && errno != EINPROGRESS) {
+        stop();
+        return 0;
+    }
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(sslclient->socket, &writeSet);
+    struct timeval tv;
+    tv.tv_sec = sslclient->handshake_timeout / 1000;
+    tv.tv_usec = (sslclient->handshake_timeout % 1000) * 1000;
+    int socketError = 0;
+    socklen_t errorLength = sizeof(socketError);
+    if (select(sslclient->socket + 1, NULL, &writeSet, NULL, &tv) <= 0 ||
+        getsockopt(sslclient->socket, SOL_SOCKET, SO_ERROR, &socketError, &errorLength) < 0 || socketError != 0) {
+        stop();
+        return 0;
+    }
+    fcntl(sslclient->socket, F_SETFL, fcntl(sslclient->socket, F_GETFL, 0) & ~O_NONBLOCK);
+    lwip_setsockopt(sslclient->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    lwip_setsockopt(sslclient->socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int enable = 1;
+    lwip_setsockopt(sslclient->socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    lwip_setsockopt(sslclient->socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    
+    static const char pers[] = "esp32-tls";
+    int ret = mbedtls_ctr_drbg_seed(&sslclient->drbg_ctx, mbedtls_entropy_func, &sslclient->entropy_ctx,
+                                    (const unsigned char*)pers, sizeof(pers) - 1);
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&sslclient->ssl_conf, MBEDTLS_SSL_IS_CLIENT,
+                                          MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret == 0) {
+#if TLS_VERIFY_CHAIN && !(BENCHMARK_MODE && defined(BENCH_HOST))
+        if (loadRootCaChain()) {
+            mbedtls_ssl_conf_authmode(&sslclient->ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+            mbedtls_ssl_conf_ca_chain(&sslclient->ssl_conf, &rootCaChain, NULL);
+            mbedtls_ssl_conf_verify(&sslclient->ssl_conf, tlsVerifyCallback, NULL);
+        } else {
+            ret = -1;
+        }
+#else
+        // チェーン検証を無効にした場合・モックサーバー（自己署名）ではピンのみで確認
+        mbedtls_ssl_conf_authmode(&sslclient->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
+#endif
+    }
+    if (ret == 0) {
+        mbedtls_ssl_conf_rng(&sslclient->ssl_conf, mbedtls_ctr_drbg_random, &sslclient->drbg_ctx);
+        ret = mbedtls_ssl_setup(&sslclient->ssl_ctx, &sslclient->ssl_conf);
+    }
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&sslclient->ssl_ctx, host);
+    }
+    if (ret == 0 && tlsSessionLength > 0) {
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        if (mbedtls_ssl_session_load(&session, tlsSessionBlob, tlsSessionLength) != 0 ||
+            mbedtls_ssl_set_session(&sslclient->ssl_ctx, &session) != 0) {
+            LOG_W("[TLS] Saved session unusable, doing a full handshake");
+            tlsSessionLength = 0;
+        } else {
+            LOG_D("[TLS] Offering saved session");
+        }
+        mbedtls_ssl_session_free(&session);
+    }
+    if (ret != 0) {
+        LOG_E("[TLS] Setup failed: -0x%04x", (unsigned int)-ret);
+        stop();
+        return 0;
+    }
+    mbedtls_ssl_set_bio(&sslclient->ssl_ctx, &sslclient->socket, mbedtls_net_send, mbedtls_net_recv, NULL);
+    
+    unsigned long handshakeStart = millis();
+    while ((ret = mbedtls_ssl_handshake(&sslclient->ssl_ctx)) != 0) {
+        if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+            millis() - handshakeStart > sslclient->handshake_timeout) {
+            if (ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
+                LOG_E("[TLS] Server certificate chain not trusted, flags: 0x%lx",
+                      (unsigned long)mbedtls_ssl_get_verify_result(&sslclient->ssl_ctx));
+            } else {
+                LOG_E("[TLS] Handshake failed: -0x%04x", (unsigned int)-ret);
+            }
+            _lastError = ret;
+            stop();
+            return 0;
+        }
+        vTaskDelay(2);
+    }
+    _lastError = 0;
+    _connected = true;
+    return 1;
+}
+
+// 確立したセッションをRTCメモリに保存（次の接続・Deep sleep復帰後の再開用）
+void SessionTlsClient::saveSession() {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    size_t length = 0;
+    if (mbedtls_ssl_get_session(&sslclient->ssl_ctx, &session) == 0 &&
+        mbedtls_ssl_session_save(&session, tlsSessionBlob, sizeof(tlsSessionBlob), &length) == 0) {
+        tlsSessionLength = length;
+    } else {
+        LOG_D("[TLS] Session not saved");
+        tlsSessionLength = 0;
+    }
+    mbedtls_ssl_session_free(&session);
+}
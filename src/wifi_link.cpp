@@ -0,0 +1,118 @@
+#include "wifi_link.h"
+#include <WiFi.h>
+#include "esp_timer.h"
+#include "app_state.h"
+#include "app_log.h"
+#include "runtime_settings.h"
+#include "power_stats.h"
+
+// WiFi設定（config.hから読み込み）
+const char* ssid     = WIFI_SSID;
+const char* password = WIFI_PASSWORD;
+
+// WiFi再接続設定（リトライ回数は実行時設定、待機は失敗ごとに倍々＋ジッター）
+const unsigned long WIFI_RETRY_DELAY = 5000; // 5秒
+const unsigned long WIFI_RETRY_MAX_DELAY = 60000; // 60秒
+const unsigned long WIFI_FAST_CONNECT_TIMEOUT = 3000; // キャッシュAPへの接続待ち（3秒）
+
+// 前回接続したAPの情報（RTCメモリ保持、Deep sleep復帰時のスキャンを省略）
+struct WiFiApCache {
+    bool valid;
+    uint8_t bssid[6];
+    int32_t channel;
+};
+RTC_DATA_ATTR WiFiApCache wifiCache = {false, {0}, 0};
+
+// 固定IP設定を適用（config.hでSTATIC_IPを定義した場合のみ、DHCPを省略）
+void applyStaticIpConfig() {
+#ifdef STATIC_IP
+    IPAddress localIp, gateway, subnet, dns;
+    localIp.fromString(STATIC_IP);
+    gateway.fromString(STATIC_GATEWAY);
+    subnet.fromString(STATIC_SUBNET);
+    dns.fromString(STATIC_DNS);
+    if (!WiFi.config(localIp, gateway, subnet, dns)) {
+        LOG_W("[WiFi] Static IP configuration failed, using DHCP");
+    }
+#endif
+}
+
+// 接続完了を待つ（50ms刻みでポーリング）
+bool waitForWiFiConnection(unsigned long timeoutMs) {
+    unsigned long startTime = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - startTime < timeoutMs) {
+        delay(50);
+    }
+    return WiFi.status() == WL_CONNECTED;
+}
+
+// WiFi接続（複数のタスクから呼ばれるため、接続処理は同時に1つだけ行う）
+// 待っている間に他のタスクが接続した場合はそのまま成功を返す
+bool connectToWiFi() {
+    xSemaphoreTake(wifiMutex, portMAX_DELAY);
+    bool connected = WiFi.status() == WL_CONNECTED || connectToWiFiLocked();
+    xSemaphoreGive(wifiMutex);
+    return connected;
+}
+
+// WiFi接続関数（エラーハンドリング付き、wifiMutex取得済みで呼ぶ）
+// 前回接続したAPのBSSID・チャンネルが分かっていればスキャンを省略して高速接続
+bool connectToWiFiLocked() {
+    int64_t wifiStart = esp_timer_get_time();
+    WiFi.persistent(false);  // 毎回のフラッシュ書き込みを避ける
+    WiFi.mode(WIFI_STA);
+    WiFi.setSleep(false);
+    applyStaticIpConfig();
+    
+    if (wifiCache.valid) {
+        LOG_I("[WiFi] Fast connect on channel %d", (int)wifiCache.channel);
+        
+        WiFi.begin(ssid, password, wifiCache.channel, wifiCache.bssid, true);
+        if (waitForWiFiConnection(WIFI_FAST_CONNECT_TIMEOUT)) {
+            recordPhase(PHASE_WIFI, wifiStart);
+            LOG_I("[WiFi] Connected successfully (cached AP)!");
+            LOG_I("[WiFi] IP address: %s", WiFi.localIP().toString().c_str());
+            LOG_I("[WiFi] Signal strength: %d dBm", WiFi.RSSI());
+            return true;
+        }
+        
+        // APが変わった可能性があるためキャッシュを破棄して通常接続
+        LOG_W("[WiFi] Fast connect failed, falling back to full scan");
+        wifiCache.valid = false;
+        WiFi.disconnect();
+    }
+    
+    for (int retry = 0; retry < settings.maxWifiRetry; retry++) {
+        LOG_I("[WiFi] Connecting attempt %d/%d", retry + 1, settings.maxWifiRetry);
+        
+        WiFi.begin(ssid, password);
+        
+        if (waitForWiFiConnection(15000)) {
+            recordPhase(PHASE_WIFI, wifiStart);
+            LOG_I("[WiFi] Connected successfully!");
+            LOG_I("[WiFi] IP address: %s", WiFi.localIP().toString().c_str());
+            LOG_I("[WiFi] Signal strength: %d dBm", WiFi.RSSI());
+            
+            // 次回の高速接続用にAP情報を保存
+            uint8_t* bssid = WiFi.BSSID();
+            if (bssid != nullptr) {
+                memcpy(wifiCache.bssid, bssid, sizeof(wifiCache.bssid));
+                wifiCache.channel = WiFi.channel();
+                wifiCache.valid = true;
+            }
+            return true;
+        } else {
+            LOG_W("[WiFi] Connection failed. Status: %d", (int)WiFi.status());
+            
+            if (retry < settings.maxWifiRetry - 1) {
+                // 同時に失敗した端末がそろって再接続しないよう、待機を倍々に延ばしてばらつかせる
+                unsigned long retryDelay = backoffDelayMs(retry, WIFI_RETRY_DELAY, WIFI_RETRY_MAX_DELAY, esp_random());
+                LOG_W("[WiFi] Retrying in %lu ms...", retryDelay);
+                delay(retryDelay);
+            }
+        }
+    }
+    
+    LOG_E("[WiFi] Failed to connect after all retries!");
+    return false;
+}
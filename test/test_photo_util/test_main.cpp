@@ -0,0 +1,311 @@
+// include/photo_util.h の単体テスト（pio test -e native）
+#include <unity.h>
+#include "photo_util.h"
+
+void setUp() {}
+void tearDown() {}
+
+// ---- フェーズ統計 ----
+
+void test_phase_stats_first_sample() {
+    PhaseStats stats = {};
+    updatePhaseStats(stats, 8000);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.count);
+    TEST_ASSERT_EQUAL_UINT32(8000, stats.lastUs);
+    TEST_ASSERT_EQUAL_UINT32(8000, stats.minUs);
+    TEST_ASSERT_EQUAL_UINT32(8000, stats.maxUs);
+    TEST_ASSERT_EQUAL_UINT32(8000, stats.avgUs);
+}
+
+void test_phase_stats_tracks_extremes_and_average() {
+    PhaseStats stats = {};
+    updatePhaseStats(stats, 8000);
+    updatePhaseStats(stats, 16000);
+    updatePhaseStats(stats, 800);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.count);
+    TEST_ASSERT_EQUAL_UINT32(800, stats.lastUs);
+    TEST_ASSERT_EQUAL_UINT32(800, stats.minUs);
+    TEST_ASSERT_EQUAL_UINT32(16000, stats.maxUs);
+    // 8000 → 9000 → 7975（新しい値の重みは1/8）
+    TEST_ASSERT_EQUAL_UINT32(7975, stats.avgUs);
+
+    // 一定の値が続けば平均はその値に近づく
+    for (int i = 0; i < 100; i++) {
+        updatePhaseStats(stats, 2000);
+    }
+    TEST_ASSERT_UINT32_WITHIN(16, 2000, stats.avgUs);
+}
+
+// ---- HTTPレスポンスパーサー ----
+
+static size_t feedText(HttpResponseParser& parser, const char* text) {
+    return feedResponseParser(parser, (const uint8_t*)text, strlen(text));
+}
+
+void test_parser_reads_status_and_headers() {
+    HttpResponseParser parser;
+    resetResponseParser(parser, nullptr, false);
+    const char* response =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 2\r\n"
+        "Date: Tue, 14 Oct 2025 03:04:05 GMT\r\n"
+        "Retry-After: 30\r\n"
+        "\r\n"
+        "{}";
+    TEST_ASSERT_EQUAL_UINT(strlen(response), feedText(parser, response));
+    TEST_ASSERT_EQUAL(HttpResponseParser::DONE, parser.state);
+    TEST_ASSERT_EQUAL_INT(200, parser.statusCode);
+    TEST_ASSERT_TRUE(parser.keepAlive);
+    TEST_ASSERT_EQUAL_INT(30, parser.retryAfterSec);
+    TEST_ASSERT_EQUAL_STRING("Tue, 14 Oct 2025 03:04:05 GMT", parser.date);
+}
+
+void test_parser_fills_capture() {
+    char body[8];
+    ResponseCapture capture = {};
+    capture.body = body;
+    capture.bodySize = sizeof(body);
+    HttpResponseParser parser;
+    resetResponseParser(parser, &capture, false);
+    feedText(parser,
+             "HTTP/1.1 201 Created\r\n"
+             "ETag: \"v2\"\r\n"
+             "Location: /upload/resumable/abc\r\n"
+             "Upload-Offset: 4096\r\n"
+             "Content-Length: 12\r\n"
+             "\r\n"
+             "0123456789ab");
+    TEST_ASSERT_EQUAL(HttpResponseParser::DONE, parser.state);
+    TEST_ASSERT_EQUAL_STRING("\"v2\"", capture.etag);
+    TEST_ASSERT_EQUAL_STRING("/upload/resumable/abc", capture.location);
+    TEST_ASSERT_EQUAL_INT(4096, capture.uploadOffset);
+    // 収まらない分は切り詰め、常にNUL終端
+    TEST_ASSERT_EQUAL_UINT(7, capture.bodyLength);
+    TEST_ASSERT_EQUAL_STRING("0123456", body);
+    TEST_ASSERT_TRUE(capture.bodyTruncated);
+}
+
+void test_parser_stops_at_end_of_pipelined_response() {
+    const char* stream =
+        "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nabc"
+        "HTTP/1.1 204 No Content\r\n\r\n";
+    size_t total = strlen(stream);
+
+    // 1つ目の途中（ヘッダーの途中）で読み込みが分かれても結果は同じ
+    for (size_t split = 1; split < total; split++) {
+        HttpResponseParser parser;
+        resetResponseParser(parser, nullptr, false);
+        size_t consumed = feedResponseParser(parser, (const uint8_t*)stream, split);
+        if (parser.state != HttpResponseParser::DONE) {
+            TEST_ASSERT_EQUAL_UINT(split, consumed);
+            consumed += feedResponseParser(parser, (const uint8_t*)stream + consumed, total - consumed);
+        }
+        TEST_ASSERT_EQUAL(HttpResponseParser::DONE, parser.state);
+        TEST_ASSERT_EQUAL_INT(200, parser.statusCode);
+        // 2つ目のレスポンスは消費せずに残す
+        TEST_ASSERT_EQUAL_STRING("HTTP/1.1 204 No Content\r\n\r\n", stream + consumed);
+
+        resetResponseParser(parser, nullptr, false);
+        consumed += feedResponseParser(parser, (const uint8_t*)stream + consumed, total - consumed);
+        TEST_ASSERT_EQUAL(HttpResponseParser::DONE, parser.state);
+        TEST_ASSERT_EQUAL_INT(204, parser.statusCode);
+        TEST_ASSERT_EQUAL_UINT(total, consumed);
+    }
+}
+
+void test_parser_closes_on_unknown_length() {
+    HttpResponseParser parser;
+    resetResponseParser(parser, nullptr, false);
+    feedText(parser, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    TEST_ASSERT_EQUAL(HttpResponseParser::DONE, parser.state);
+    TEST_ASSERT_FALSE(parser.keepAlive);
+
+    resetResponseParser(parser, nullptr, false);
+    feedText(parser, "HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n");
+    TEST_ASSERT_FALSE(parser.keepAlive);
+
+    resetResponseParser(parser, nullptr, false);
+    feedText(parser, "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+    TEST_ASSERT_FALSE(parser.keepAlive);
+}
+
+void test_parser_head_request_has_no_body() {
+    HttpResponseParser parser;
+    resetResponseParser(parser, nullptr, true);
+    const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 1024\r\n\r\n";
+    TEST_ASSERT_EQUAL_UINT(strlen(response), feedText(parser, response));
+    TEST_ASSERT_EQUAL(HttpResponseParser::DONE, parser.state);
+    TEST_ASSERT_TRUE(parser.keepAlive);
+}
+
+void test_parser_keeps_error_body() {
+    HttpResponseParser parser;
+    resetResponseParser(parser, nullptr, false);
+    feedText(parser, "HTTP/1.1 409 Conflict\r\nContent-Length: 9\r\n\r\nduplicate");
+    TEST_ASSERT_EQUAL_INT(409, parser.statusCode);
+    parser.errorBody[parser.errorBodyLength] = '\0';
+    TEST_ASSERT_EQUAL_STRING("duplicate", parser.errorBody);
+}
+
+void test_parser_rejects_garbage() {
+    HttpResponseParser parser;
+    resetResponseParser(parser, nullptr, false);
+    feedText(parser, "SSH-2.0-OpenSSH\r\n");
+    TEST_ASSERT_EQUAL(HttpResponseParser::FAILED, parser.state);
+}
+
+// ---- Dateヘッダー ----
+
+void test_http_date() {
+    time_t epoch = 0;
+    TEST_ASSERT_TRUE(parseHttpDate("Thu, 01 Jan 1970 00:00:00 GMT", epoch));
+    TEST_ASSERT_EQUAL_INT64(0, (int64_t)epoch);
+    TEST_ASSERT_TRUE(parseHttpDate("Tue, 14 Oct 2025 03:04:05 GMT", epoch));
+    TEST_ASSERT_EQUAL_INT64(1760411045LL, (int64_t)epoch);
+    TEST_ASSERT_TRUE(parseHttpDate("Thu, 29 Feb 2024 12:00:00 GMT", epoch));
+    TEST_ASSERT_EQUAL_INT64(1709208000LL, (int64_t)epoch);
+    TEST_ASSERT_FALSE(parseHttpDate("Tue, 14 Foo 2025 03:04:05 GMT", epoch));
+    TEST_ASSERT_FALSE(parseHttpDate("Tue, 14 anF 2025 03:04:05 GMT", epoch));
+    TEST_ASSERT_FALSE(parseHttpDate("garbage", epoch));
+}
+
+// ---- JSON ----
+
+void test_json_get_int() {
+    long value = 0;
+    TEST_ASSERT_TRUE(jsonGetInt("{\"interval_s\": 3600, \"chunk\":-5}", "interval_s", value));
+    TEST_ASSERT_EQUAL_INT(3600, value);
+    TEST_ASSERT_TRUE(jsonGetInt("{\"interval_s\": 3600, \"chunk\":-5}", "chunk", value));
+    TEST_ASSERT_EQUAL_INT(-5, value);
+    TEST_ASSERT_FALSE(jsonGetInt("{\"interval_s\": 3600}", "chunk", value));
+    TEST_ASSERT_FALSE(jsonGetInt("{\"chunk\": \"big\"}", "chunk", value));
+}
+
+void test_json_get_string() {
+    char out[8];
+    TEST_ASSERT_TRUE(jsonGetString("{\"bucket\" : \"photos\"}", "bucket", out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING("photos", out);
+    // 収まらない値は切り詰めずに失敗
+    TEST_ASSERT_FALSE(jsonGetString("{\"bucket\": \"photos-long\"}", "bucket", out, sizeof(out)));
+    TEST_ASSERT_FALSE(jsonGetString("{\"bucket\": 3}", "bucket", out, sizeof(out)));
+}
+
+// ---- 証明書ピン ----
+
+void test_spki_pins() {
+    uint8_t pins[3][32];
+    const char* two =
+        "000102030405060708090A0B0C0D0E0F101112131415161718191a1b1c1d1e1f, "
+        "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff";
+    TEST_ASSERT_EQUAL_INT(2, parseSpkiPins(two, pins, 3));
+    for (int i = 0; i < 32; i++) {
+        TEST_ASSERT_EQUAL_HEX8(i, pins[0][i]);
+        TEST_ASSERT_EQUAL_HEX8(0xFF, pins[1][i]);
+    }
+    TEST_ASSERT_EQUAL_INT(0, parseSpkiPins("", pins, 3));
+    TEST_ASSERT_EQUAL_INT(-1, parseSpkiPins("0011", pins, 3));
+    TEST_ASSERT_EQUAL_INT(-1, parseSpkiPins(
+        "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1fzz", pins, 3));
+}
+
+// ---- 動き検知 ----
+
+void test_sum_abs_diff7() {
+    // 16bitレーンの累積が溢れないよう区切る境界（128ワード）をまたぐ長さで比較
+    const int words = 300;
+    static uint32_t a[words], b[words];
+    uint32_t expected = 0;
+    uint32_t seed = 12345;
+    for (int i = 0; i < words; i++) {
+        a[i] = 0;
+        b[i] = 0;
+        for (int k = 0; k < 4; k++) {
+            seed = seed * 1103515245u + 12345u;
+            uint32_t pa = (seed >> 16) & 0x7F;
+            seed = seed * 1103515245u + 12345u;
+            uint32_t pb = (seed >> 16) & 0x7F;
+            expected += pa > pb ? pa - pb : pb - pa;
+            a[i] |= pa << (8 * k);
+            b[i] |= pb << (8 * k);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(expected, sumAbsDiff7(a, b, words));
+
+    // 全画素が最大差（127）でも溢れない
+    for (int i = 0; i < words; i++) {
+        a[i] = 0x7F7F7F7F;
+        b[i] = 0;
+    }
+    TEST_ASSERT_EQUAL_UINT32(127u * 4 * words, sumAbsDiff7(a, b, words));
+    TEST_ASSERT_EQUAL_UINT32(127u * 4 * words, sumAbsDiff7(b, a, words));
+}
+
+// ---- バックオフ・撮影枠 ----
+
+void test_backoff_delay() {
+    TEST_ASSERT_EQUAL_UINT(500, backoffDelayMs(0, 1000, 60000, 0));
+    TEST_ASSERT_EQUAL_UINT(1000, backoffDelayMs(0, 1000, 60000, 500));
+    TEST_ASSERT_EQUAL_UINT(4000, backoffDelayMs(3, 1000, 60000, 0));
+    // 上限で打ち切る（attemptが大きくても溢れない）
+    TEST_ASSERT_EQUAL_UINT(30000, backoffDelayMs(40, 1000, 60000, 0));
+    TEST_ASSERT_EQUAL_UINT(60000, backoffDelayMs(40, 1000, 60000, 30000));
+}
+
+void test_slot_offset() {
+    TEST_ASSERT_EQUAL_UINT(0, slotOffsetSec(12345, 3600, 0));
+    TEST_ASSERT_EQUAL_UINT(12345 % 600, slotOffsetSec(12345, 3600, 600));
+    // 間隔より広くは散らさない
+    TEST_ASSERT_EQUAL_UINT(12345 % 60, slotOffsetSec(12345, 60, 600));
+}
+
+void test_next_shot_slot() {
+    const time_t hour = 3600;
+    // 枠は offset（120秒）ずらした毎時
+    TEST_ASSERT_EQUAL_INT64(3720, (int64_t)nextShotSlot(3700, hour, 120, false));
+    TEST_ASSERT_EQUAL_INT64(7320, (int64_t)nextShotSlot(3720, hour, 120, false));
+    // 撮影直後に時刻が数秒戻っても、撮影したばかりの枠は返さない
+    TEST_ASSERT_EQUAL_INT64(3720, (int64_t)nextShotSlot(3715, hour, 120, false));
+    TEST_ASSERT_EQUAL_INT64(7320, (int64_t)nextShotSlot(3715, hour, 120, true));
+    // 撮影直後でも半周期以上先の枠はそのまま
+    TEST_ASSERT_EQUAL_INT64(7320, (int64_t)nextShotSlot(5000, hour, 120, true));
+}
+
+// ---- Supabase URLの解析 ----
+
+constexpr char TEST_URL[] = "https://abc.supabase.co:8443/storage";
+static_assert(urlSchemeLength(TEST_URL) == 8, "https scheme");
+static_assert(urlHostLength(TEST_URL + 8) == 15, "host length");
+static_assert(urlPort(TEST_URL + 8 + 15) == 8443, "explicit port");
+static_assert(urlPort("") == 443, "default port");
+static_assert(urlSchemeLength("ftp://abc") == 0, "unsupported scheme");
+
+void test_url_helpers() {
+    const char* url = "http://example.com/path";
+    TEST_ASSERT_EQUAL_UINT(7, urlSchemeLength(url));
+    TEST_ASSERT_EQUAL_UINT(11, urlHostLength(url + 7));
+    TEST_ASSERT_EQUAL_UINT(443, urlPort(url + 7 + 11));
+    TEST_ASSERT_EQUAL_UINT(0, urlHostLength(""));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_phase_stats_first_sample);
+    RUN_TEST(test_phase_stats_tracks_extremes_and_average);
+    RUN_TEST(test_parser_reads_status_and_headers);
+    RUN_TEST(test_parser_fills_capture);
+    RUN_TEST(test_parser_stops_at_end_of_pipelined_response);
+    RUN_TEST(test_parser_closes_on_unknown_length);
+    RUN_TEST(test_parser_head_request_has_no_body);
+    RUN_TEST(test_parser_keeps_error_body);
+    RUN_TEST(test_parser_rejects_garbage);
+    RUN_TEST(test_http_date);
+    RUN_TEST(test_json_get_int);
+    RUN_TEST(test_json_get_string);
+    RUN_TEST(test_spki_pins);
+    RUN_TEST(test_sum_abs_diff7);
+    RUN_TEST(test_backoff_delay);
+    RUN_TEST(test_slot_offset);
+    RUN_TEST(test_next_shot_slot);
+    RUN_TEST(test_url_helpers);
+    return UNITY_END();
+}
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+Supabase Storage のアップロードAPIを模したローカルHTTPSサーバー（ベンチマーク用）
+
+使い方:
+    openssl req -x509 -newkey rsa:2048 -nodes -keyout key.pem -out cert.pem -days 365 -subj "/CN=bench"
+    python3 tools/mock_upload_server.py --port 8443 --cert cert.pem --key key.pem
+
+POSTされたボディを読み捨て、keep-alive を維持したまま 200 を返す。
+再開可能アップロード（/storage/v1/upload/resumable、tusプロトコル）にも対応し、
+--drop-patch を付けると各アップロードの最初のPATCHを途中で切断して再開動作を確認できる。
+"""
+
+import argparse
+import http.server
+import ssl
+import time
+import uuid
+
+RESUMABLE_PATH = "/storage/v1/upload/resumable"
+uploads = {}  # アップロードID -> {"length": 全体サイズ, "offset": 受信済みバイト数, "dropped": 切断済みか}
+
+
+class UploadHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"  # keep-alive を有効化
+    drop_patch = False
+
+    def read_body(self, limit=None):
+        remaining = int(self.headers.get("Content-Length", 0))
+        if limit is not None:
+            remaining = min(remaining, limit)
+        received = 0
+        while remaining > 0:
+            chunk = self.rfile.read(min(remaining, 65536))
+            if not chunk:
+                break
+            remaining -= len(chunk)
+            received += len(chunk)
+        return received
+
+    def send_empty(self, status, headers=None):
+        self.send_response(status)
+        self.send_header("Tus-Resumable", "1.0.0")
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def do_POST(self):
+        if self.path == RESUMABLE_PATH:
+            upload_id = uuid.uuid4().hex
+            uploads[upload_id] = {"length": int(self.headers.get("Upload-Length", 0)), "offset": 0, "dropped": False}
+            self.read_body()
+            host = self.headers.get("Host", "localhost")
+            self.send_empty(201, {"Location": f"https://{host}{RESUMABLE_PATH}/{upload_id}"})
+            print(f"{self.path} created {upload_id}, {uploads[upload_id]['length']} bytes")
+            return
+
+        start = time.monotonic()
+        self.read_body()
+        elapsed = (time.monotonic() - start) * 1000
+
+        body = b'{"Key":"mock"}'
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+        timing = self.headers.get("X-Shot-Timing", "-")
+        print(f"{self.path} {self.headers.get('Content-Length')} bytes, body {elapsed:.0f} ms, timing {timing}")
+
+    def do_HEAD(self):
+        upload = uploads.get(self.path.rsplit("/", 1)[-1])
+        if upload is None:
+            self.send_empty(404)
+            return
+        self.send_empty(200, {"Upload-Offset": str(upload["offset"]), "Upload-Length": str(upload["length"])})
+        print(f"{self.path} HEAD offset {upload['offset']}")
+
+    def do_PATCH(self):
+        upload = uploads.get(self.path.rsplit("/", 1)[-1])
+        if upload is None:
+            self.read_body()
+            self.send_empty(404)
+            return
+        if int(self.headers.get("Upload-Offset", -1)) != upload["offset"]:
+            self.read_body()
+            self.send_empty(409)
+            return
+
+        length = int(self.headers.get("Content-Length", 0))
+        if self.drop_patch and not upload["dropped"]:
+            # 半分だけ受け取って切断（電波断の再現）
+            upload["dropped"] = True
+            upload["offset"] += self.read_body(length // 2)
+            print(f"{self.path} PATCH dropped at {upload['offset']}")
+            self.close_connection = True
+            self.connection.close()
+            return
+
+        upload["offset"] += self.read_body()
+        self.send_empty(204, {"Upload-Offset": str(upload["offset"])})
+        print(f"{self.path} PATCH {length} bytes, offset {upload['offset']}/{upload['length']}")
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--cert", default="cert.pem")
+    parser.add_argument("--key", default="key.pem")
+    parser.add_argument("--drop-patch", action="store_true", help="各アップロードの最初のPATCHを途中で切断")
+    args = parser.parse_args()
+
+    UploadHandler.drop_patch = args.drop_patch
+    server = http.server.ThreadingHTTPServer(("0.0.0.0", args.port), UploadHandler)
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(args.cert, args.key)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    print(f"Mock upload server listening on :{args.port}")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()